@@ -0,0 +1,371 @@
+// Benchmark.cc
+//
+// Generates a synthetic railway network and times every public operation of
+// Datastructures. Results are printed as one JSON object per line.
+//
+// Build separately from the main program with the benchmark target of CMakeLists.txt:
+//   cmake -S . -B build && cmake --build build --target benchmark
+// or directly:
+//   g++ -std=c++17 -O2 -pthread benchmark.cc datastructures.cc -o benchmark
+//
+// Usage:
+//   benchmark [stations] [regions] [region_depth] [trains] [route_length] [samples] [seed]
+
+
+#include "datastructures.hh"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+std::minstd_rand bench_engine; // Same generator type as in datastructures.cc
+
+struct Scale
+{
+    unsigned int stations = 10000;
+    unsigned int regions = 1000;
+    unsigned int region_depth = 6;
+    unsigned int trains = 2000;
+    unsigned int route_length = 12;
+    unsigned int samples = 200;
+    unsigned int seed = 1;
+};
+
+// Generated network, kept outside Datastructures so the same data can be reloaded
+struct Network
+{
+    std::vector<std::tuple<StationID, Name, Coord>> stations;
+    std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> regions;
+    std::vector<std::pair<RegionID, RegionID>> subregions;
+    std::vector<std::pair<StationID, RegionID>> station_regions;
+    std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> trains;
+};
+
+/**
+ * @brief random_between, uniform random integer
+ * @param start, smallest value
+ * @param end, largest value
+ * @return value in [start, end]
+ */
+unsigned int random_between(unsigned int start, unsigned int end)
+{
+    return std::uniform_int_distribution<unsigned int>(start, end)(bench_engine);
+}
+
+/**
+ * @brief generate_network, build a random network of the given scale
+ * @param scale, sizes of the network
+ * @return the network
+ */
+Network generate_network(Scale const& scale)
+{
+    Network network;
+    int const side = 1000 * static_cast<int>(std::sqrt(static_cast<double>(scale.stations)) + 1);
+    for(unsigned int i = 0; i < scale.stations; i++){
+        Coord xy = {static_cast<int>(random_between(0, side)), static_cast<int>(random_between(0, side))};
+        network.stations.push_back({"S" + std::to_string(i), "Station " + std::to_string(random_between(0, scale.stations)), xy});
+    }
+
+    // Regions form a forest of at most region_depth levels, each region is a square
+    // inside its parent's square
+    std::vector<std::pair<Coord, int>> squares;
+    std::vector<unsigned int> depth;
+    for(unsigned int i = 0; i < scale.regions; i++){
+        Coord corner = {0, 0};
+        int size = side;
+        unsigned int level = 0;
+        if(i > 0 && random_between(0, 9) != 0){
+            unsigned int parent = random_between(0, i - 1);
+            if(depth[parent] + 1 < scale.region_depth && squares[parent].second > 4){
+                int half = squares[parent].second / 2;
+                corner = {squares[parent].first.x + static_cast<int>(random_between(0, half)),
+                          squares[parent].first.y + static_cast<int>(random_between(0, half))};
+                size = half;
+                level = depth[parent] + 1;
+                network.subregions.push_back({i, parent});
+            }
+        }
+        squares.push_back({corner, size});
+        depth.push_back(level);
+        network.regions.push_back({i, "Region " + std::to_string(i),
+                                   {corner, {corner.x + size, corner.y}, {corner.x + size, corner.y + size},
+                                    {corner.x, corner.y + size}}});
+    }
+    for(unsigned int i = 0; i < scale.stations && scale.regions > 0; i += 2){
+        network.station_regions.push_back({"S" + std::to_string(i), random_between(0, scale.regions - 1)});
+    }
+
+    for(unsigned int i = 0; i < scale.trains && scale.stations > 1; i++){
+        std::vector<std::pair<StationID, Time>> route;
+        Time time = random_between(0, 1200);
+        for(unsigned int j = 0; j < scale.route_length; j++){
+            route.push_back({"S" + std::to_string(random_between(0, scale.stations - 1)), time});
+            time += random_between(1, 15);
+        }
+        network.trains.push_back({"T" + std::to_string(i), route});
+    }
+    return network;
+}
+
+/**
+ * @brief load_network, add the whole network with the single element add_* operations
+ * @param ds, datastructure to fill
+ * @param network, network to add
+ */
+void load_network(Datastructures& ds, Network const& network)
+{
+    for(auto &[id, name, xy] : network.stations){
+        ds.add_station(id, name, xy);
+    }
+    for(auto &[id, name, coords] : network.regions){
+        ds.add_region(id, name, coords);
+    }
+    for(auto &[id, parentid] : network.subregions){
+        ds.add_subregion_to_region(id, parentid);
+    }
+    for(auto &[id, parentid] : network.station_regions){
+        ds.add_station_to_region(id, parentid);
+    }
+    for(auto &[id, route] : network.trains){
+        ds.add_train(id, route);
+    }
+}
+
+/**
+ * @brief report, print timing results of one operation as JSON
+ * @param operation, name of the operation
+ * @param scale, sizes of the network
+ * @param cold, time of the first call in microseconds
+ * @param warm, times of the following calls in microseconds
+ */
+void report(std::string const& operation, Scale const& scale, double cold, std::vector<double> warm)
+{
+    std::sort(warm.begin(), warm.end());
+    auto percentile = [&warm](double p){
+        return warm.empty() ? 0.0 : warm[std::min(warm.size() - 1, static_cast<std::size_t>(p * warm.size()))];
+    };
+    std::cout << "{\"operation\":\"" << operation << "\""
+              << ",\"stations\":" << scale.stations << ",\"regions\":" << scale.regions
+              << ",\"trains\":" << scale.trains << ",\"route_length\":" << scale.route_length
+              << ",\"samples\":" << warm.size() << ",\"cold_us\":" << cold
+              << ",\"p50_us\":" << percentile(0.50) << ",\"p90_us\":" << percentile(0.90)
+              << ",\"p99_us\":" << percentile(0.99) << ",\"max_us\":" << (warm.empty() ? 0.0 : warm.back())
+              << "}" << std::endl;
+}
+
+/**
+ * @brief report_settled, print how many stations route_shortest_distance settles on average as JSON
+ * @param mode, search mode in use
+ * @param scale, sizes of the network
+ * @param ds, datastructure to query
+ * @param station, function giving the station ID of a sample number
+ */
+template <typename Station>
+void report_settled(std::string const& mode, Scale const& scale, Datastructures& ds, Station station)
+{
+    double total = 0;
+    for(unsigned int i = 1; i <= scale.samples; i++){
+        ds.route_shortest_distance(station(i), station(i + 1));
+        total += ds.last_route_settled();
+    }
+    std::cout << "{\"operation\":\"route_shortest_distance_settled\",\"mode\":\"" << mode << "\""
+              << ",\"stations\":" << scale.stations << ",\"samples\":" << scale.samples
+              << ",\"mean_settled\":" << (scale.samples == 0 ? 0.0 : total / scale.samples) << "}" << std::endl;
+}
+
+/**
+ * @brief measure, time one call
+ * @param call, function to time
+ * @return elapsed time in microseconds
+ */
+template <typename Call>
+double measure(Call call)
+{
+    auto start = std::chrono::steady_clock::now();
+    call();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+/**
+ * @brief bench, time an operation once cold and then samples times warm
+ * @param operation, name of the operation
+ * @param scale, sizes of the network
+ * @param call, function taking the sample number
+ */
+template <typename Call>
+void bench(std::string const& operation, Scale const& scale, Call call)
+{
+    try {
+        double cold = measure([&call](){call(0);});
+        std::vector<double> warm;
+        for(unsigned int i = 1; i <= scale.samples; i++){
+            warm.push_back(measure([&call, i](){call(i);}));
+        }
+        report(operation, scale, cold, warm);
+    } catch(NotImplemented const& error){
+        std::cout << "{\"operation\":\"" << operation << "\",\"skipped\":\"" << error.what() << "\"}" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    Scale scale;
+    std::vector<unsigned int*> fields = {&scale.stations, &scale.regions, &scale.region_depth, &scale.trains,
+                                         &scale.route_length, &scale.samples, &scale.seed};
+    for(int i = 1; i < argc && i <= static_cast<int>(fields.size()); i++){
+        *fields[i-1] = std::strtoul(argv[i], nullptr, 10);
+    }
+    if(scale.stations < 2 || scale.regions < 1){
+        std::cerr << "Need at least 2 stations and 1 region" << std::endl;
+        return EXIT_FAILURE;
+    }
+    bench_engine.seed(scale.seed);
+    Network network = generate_network(scale);
+
+    // Building the whole network is timed as a unit, one sample per rebuild
+    Datastructures ds;
+    {
+        std::vector<double> builds;
+        unsigned int rebuilds = std::max(1u, std::min(scale.samples, 5u));
+        double cold = 0;
+        for(unsigned int i = 0; i <= rebuilds; i++){
+            ds.clear_all();
+            double time = measure([&ds, &network](){load_network(ds, network);});
+            if(i == 0){
+                cold = time;
+            } else {
+                builds.push_back(time);
+            }
+        }
+        report("load_network", scale, cold, builds);
+    }
+
+    auto station = [&network](unsigned int i){
+        return std::get<0>(network.stations[(i * 7919u) % network.stations.size()]);
+    };
+    auto region = [&network](unsigned int i){
+        return std::get<0>(network.regions[(i * 104729u) % network.regions.size()]);
+    };
+    auto train = [&network](unsigned int i){
+        return network.trains.empty() ? NO_TRAIN : network.trains[(i * 7u) % network.trains.size()].first;
+    };
+    auto coord = [&network](unsigned int i){
+        return std::get<2>(network.stations[(i * 31u) % network.stations.size()]);
+    };
+
+    bench("station_count", scale, [&ds](unsigned int){ds.station_count();});
+    bench("all_stations", scale, [&ds](unsigned int){ds.all_stations();});
+    bench("get_station_name", scale, [&](unsigned int i){ds.get_station_name(station(i));});
+    bench("get_station_coordinates", scale, [&](unsigned int i){ds.get_station_coordinates(station(i));});
+    bench("stations_alphabetically", scale, [&ds](unsigned int){ds.stations_alphabetically();});
+    bench("stations_distance_increasing", scale, [&ds](unsigned int){ds.stations_distance_increasing();});
+    bench("find_station_with_coord", scale, [&](unsigned int i){ds.find_station_with_coord(coord(i));});
+    bench("stations_closest_to", scale, [&](unsigned int i){ds.stations_closest_to(coord(i));});
+    bench("station_departures_after", scale, [&](unsigned int i){ds.station_departures_after(station(i), i % 1440);});
+    bench("add_departure", scale, [&](unsigned int i){ds.add_departure(station(i), "B" + std::to_string(i), i % 1440);});
+    bench("remove_departure", scale, [&](unsigned int i){ds.remove_departure(station(i), "B" + std::to_string(i), i % 1440);});
+    bench("all_regions", scale, [&ds](unsigned int){ds.all_regions();});
+    bench("get_region_name", scale, [&](unsigned int i){ds.get_region_name(region(i));});
+    bench("get_region_coords", scale, [&](unsigned int i){ds.get_region_coords(region(i));});
+    bench("station_in_regions", scale, [&](unsigned int i){ds.station_in_regions(station(i));});
+    bench("all_subregions_of_region", scale, [&](unsigned int i){ds.all_subregions_of_region(region(i));});
+    bench("common_parent_of_regions", scale, [&](unsigned int i){ds.common_parent_of_regions(region(i), region(i + 1));});
+    bench("regions_containing", scale, [&](unsigned int i){ds.regions_containing(coord(i));});
+    bench("next_stations_from", scale, [&](unsigned int i){ds.next_stations_from(station(i));});
+    bench("train_stations_from", scale, [&](unsigned int i){
+        auto first = network.trains.empty() ? NO_STATION : network.trains[(i * 7u) % network.trains.size()].second.front().first;
+        ds.train_stations_from(first, train(i));
+    });
+    bench("route_any", scale, [&](unsigned int i){ds.route_any(station(i), station(i + 1));});
+    bench("route_least_stations", scale, [&](unsigned int i){ds.route_least_stations(station(i), station(i + 1));});
+    bench("route_with_cycle", scale, [&](unsigned int i){ds.route_with_cycle(station(i));});
+    bench("route_shortest_distance", scale, [&](unsigned int i){ds.route_shortest_distance(station(i), station(i + 1));});
+    bench("route_earliest_arrival", scale, [&](unsigned int i){ds.route_earliest_arrival(station(i), station(i + 1), i % 1440);});
+    bench("journeys_pareto", scale, [&](unsigned int i){ds.journeys_pareto(station(i), station(i + 1), i % 1440);});
+    bench("journeys_profile_3h", scale, [&](unsigned int i){ds.journeys_profile(station(i), station(i + 1), 420, 600);});
+    Reachable reachable;
+    bench("stations_within_distance_5km", scale, [&](unsigned int i){ds.stations_within_distance(station(i), 5000, reachable);});
+    bench("stations_within_time_60min", scale, [&](unsigned int i){ds.stations_within_time(station(i), i % 1440, 60, reachable);});
+    bench("route_matrix_100x100", scale, [&](unsigned int i){
+        std::vector<StationID> sources;
+        std::vector<StationID> targets;
+        for(unsigned int j = 0; j < 100; j++){
+            sources.push_back(station(i * 100 + j));
+            targets.push_back(station(i * 100 + j + 50));
+        }
+        ds.route_matrix(sources, targets);
+    });
+    // Popular pairs asked again and again, as a journey planner frontend would
+    ds.set_route_cache_capacity(1024);
+    bench("route_least_stations_cached", scale, [&](unsigned int i){ds.route_least_stations(station(i % 8), station(i % 8 + 1));});
+    ds.set_route_cache_capacity(0);
+    // Preprocessing is slow next to the queries, so it gets only a few samples
+    Scale preprocessing = scale;
+    preprocessing.samples = std::min(scale.samples, 3u);
+    ds.set_goal_directed(false);
+    report_settled("dijkstra", scale, ds, station);
+    ds.set_goal_directed(true);
+    report_settled("astar", scale, ds, station);
+    bench("build_landmarks", preprocessing, [&ds](unsigned int){ds.build_landmarks(16);});
+    bench("route_shortest_distance_landmarks", scale, [&](unsigned int i){ds.route_shortest_distance(station(i), station(i + 1));});
+    report_settled("landmarks", scale, ds, station);
+    bench("build_distance_hierarchy", preprocessing, [&ds](unsigned int){ds.build_distance_hierarchy();});
+    bench("route_shortest_distance_hierarchy", scale, [&](unsigned int i){ds.route_shortest_distance(station(i), station(i + 1));});
+    report_settled("hierarchy", scale, ds, station);
+
+    // Modifying operations last, they change the network the queries above ran on
+    bench("change_station_coord", scale, [&](unsigned int i){ds.change_station_coord(station(i), coord(i + 1));});
+    bench("add_station", scale, [&](unsigned int i){ds.add_station("N" + std::to_string(i), "New", coord(i));});
+    bench("add_region", scale, [&](unsigned int i){ds.add_region(network.regions.size() + i, "New", {coord(i)});});
+    bench("add_train", scale, [&](unsigned int i){
+        ds.add_train("N" + std::to_string(i), {{station(i), 600}, {station(i + 1), 610}, {station(i + 2), 620}});
+    });
+    bench("delay_train", scale, [&](unsigned int i){
+        if(network.trains.empty()){
+            return;
+        }
+        auto &stops = network.trains[(i * 7u) % network.trains.size()].second;
+        ds.delay_train(train(i), stops[stops.size() / 2].first, 5);
+    });
+    bench("update_train_times", scale, [&](unsigned int i){
+        if(network.trains.empty()){
+            return;
+        }
+        auto &stops = network.trains[(i * 7u) % network.trains.size()].second;
+        std::vector<Time> times;
+        for(auto &stop : stops){
+            times.push_back(stop.second + 1);
+        }
+        ds.update_train_times(train(i), times);
+    });
+    bench("remove_train", scale, [&](unsigned int i){ds.remove_train(train(i));});
+    bench("remove_station", scale, [&](unsigned int i){ds.remove_station(station(i));});
+    bench("clear_trains", scale, [&ds](unsigned int){ds.clear_trains();});
+    bench("clear_all", scale, [&ds](unsigned int){ds.clear_all();});
+
+    // Bulk loading and snapshots on a fresh datastructure
+    Datastructures bulk;
+    bench("load_network_bulk", scale, [&](unsigned int){
+        bulk.clear_all();
+        bulk.add_stations_bulk(network.stations);
+        bulk.add_regions_bulk(network.regions);
+        for(auto &[id, parentid] : network.subregions){
+            bulk.add_subregion_to_region(id, parentid);
+        }
+        bulk.add_stations_to_regions_bulk(network.station_regions);
+        bulk.add_trains_bulk(network.trains);
+    });
+    std::string const snapshot = "benchmark_snapshot.bin";
+    bench("save_snapshot", scale, [&](unsigned int){bulk.save_snapshot(snapshot);});
+    bench("load_snapshot", scale, [&](unsigned int){bulk.load_snapshot(snapshot);});
+    std::remove(snapshot.c_str());
+
+    return EXIT_SUCCESS;
+}
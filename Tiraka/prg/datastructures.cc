@@ -8,7 +8,13 @@
 #include <random>
 #include <cmath>
 #include <queue>
-#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
@@ -24,6 +30,32 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+/**
+ * @brief parallel_for, run work(begin, end) over [0, count) split into chunks, one per core
+ * @param count, number of items
+ * @param work, function processing items [begin, end), chunks must not share any written data
+ * @param min_chunk, fewest items worth a thread of their own, threads cost more than they give on small inputs
+ */
+template <typename Work>
+void parallel_for(std::size_t count, Work work, std::size_t min_chunk = 1024)
+{
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, (count + min_chunk - 1) / min_chunk);
+    if(threads <= 1){
+        work(std::size_t(0), count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    std::size_t chunk = (count + threads - 1) / threads;
+    for(std::size_t begin = chunk; begin < count; begin += chunk){
+        workers.emplace_back(work, begin, std::min(begin + chunk, count));
+    }
+    work(std::size_t(0), std::min(chunk, count));
+    for(auto &worker : workers){
+        worker.join();
+    }
+}
+
 // Modify the code below to implement the functionality of the class.
 // Also remove comments from the parameter names when you implement
 // an operation (Commenting out parameter name prevents compiler from
@@ -39,13 +71,123 @@ Datastructures::~Datastructures()
 
 }
 
+// Search state of routing queries, one per thread so that queries can run in parallel
+thread_local Datastructures::SearchScratch Datastructures::scratch;
+thread_local Datastructures::SearchScratch Datastructures::reverse_scratch;
+thread_local unsigned int Datastructures::last_settled = 0;
+
+// Datastructures whose lock the current thread already holds and whether it holds it alone.
+// Nested guards on it do nothing, except that a writer can't nest inside a reader: the shared
+// lock can't be turned into an exclusive one without letting other readers see the change.
+thread_local Datastructures const* held_lock = nullptr;
+thread_local bool held_alone = false;
+
+Datastructures::ReadLock::ReadLock(Datastructures const& ds, bool adopt)
+    : ds_{ds}, previous_{held_lock}, previous_alone_{held_alone}, owned_{held_lock != &ds}, adopted_{adopt}
+{
+    if(owned_){
+        // A worker started by a query reads under the lock of the thread that started it
+        if(!adopt){
+            if(ds_.writers_waiting != 0){
+                std::unique_lock<std::mutex> gate(ds_.gate_mutex);
+                ds_.gate_open.wait(gate, [this]{return ds_.writers_waiting == 0;});
+            }
+            ds_.rw_lock.lock_shared();
+        }
+        held_lock = &ds_;
+        held_alone = false;
+    }
+}
+
+Datastructures::ReadLock::~ReadLock()
+{
+    if(owned_){
+        held_lock = previous_;
+        held_alone = previous_alone_;
+        if(!adopted_){
+            ds_.rw_lock.unlock_shared();
+        }
+    }
+}
+
+Datastructures::WriteLock::WriteLock(Datastructures const& ds)
+    : ds_{ds}, previous_{held_lock}, previous_alone_{held_alone}, owned_{held_lock != &ds}
+{
+    if(!owned_ && !held_alone){
+        throw std::logic_error("WriteLock(): modifying operation called while a query is reading");
+    }
+    if(owned_){
+        ds_.writers_waiting++;
+        ds_.rw_lock.lock();
+        // Readers stopped at the gate go on to wait for the lock itself
+        if(--ds_.writers_waiting == 0){
+            std::lock_guard<std::mutex> gate(ds_.gate_mutex);
+            ds_.gate_open.notify_all();
+        }
+        held_lock = &ds_;
+        held_alone = true;
+    }
+}
+
+Datastructures::WriteLock::~WriteLock()
+{
+    if(owned_){
+        held_lock = previous_;
+        held_alone = previous_alone_;
+        ds_.rw_lock.unlock();
+    }
+}
+
+/**
+ * @brief Datastructures::find_station, translate station ID into its dense index
+ * @param id, station ID to look for
+ * @return index of the station, NO_INDEX if there is no such station
+ */
+Datastructures::StationIdx Datastructures::find_station(StationID const& id) const{
+    auto found_id = station_index.find(id);
+    if(found_id == station_index.end()){
+        return NO_INDEX;
+    }
+    return found_id->second;
+}
+
+/**
+ * @brief Datastructures::find_region, translate region ID into its dense index
+ * @param id, region ID to look for
+ * @return index of the region, NO_INDEX if there is no such region
+ */
+Datastructures::RegionIdx Datastructures::find_region(RegionID id) const{
+    auto found_id = region_index.find(id);
+    if(found_id == region_index.end()){
+        return NO_INDEX;
+    }
+    return found_id->second;
+}
+
+/**
+ * @brief Datastructures::intern_train, translate train ID into its dense index
+ * @param id, train ID, given a new index if it hasn't been seen before
+ * @return index of the train
+ */
+Datastructures::TrainIdx Datastructures::intern_train(TrainID const& id){
+    auto inserted = train_index.insert({id, static_cast<TrainIdx>(train_IDs.size())});
+    if(inserted.second){
+        train_IDs.push_back(id);
+        train_stops.emplace_back();
+        train_added.push_back(false);
+        connection_tail.push_back(NO_INDEX);
+    }
+    return inserted.first->second;
+}
+
 /**
  * @brief Datastructures::station_count() how many stations
  * @return int, station count
  */
-unsigned int Datastructures::station_count()
+unsigned int Datastructures::station_count() const
 {
-    return station_IDs.size();
+    ReadLock lock(*this);
+    return station_IDs.size() - removed_count;
 }
 
 /**
@@ -53,24 +195,116 @@ unsigned int Datastructures::station_count()
  */
 void Datastructures::clear_all()
 {
+    WriteLock lock(*this);
+    station_index.clear();
     station_IDs.clear();
-    stations.clear();
+    station_names.clear();
+    station_coords.clear();
+    station_region.clear();
+    station_region_position.clear();
+    station_departures.clear();
+    station_next.clear();
+    station_previous.clear();
+    station_removed.clear();
+    removed_count = 0;
+
     alphabetical_order.clear();
     coordinates.clear();
+    alphabetical_sorted = 0;
+    coordinates_sorted = 0;
+    coordinates_moved.clear();
+    alphabetical_IDs.clear();
+    coordinates_IDs.clear();
+    alphabetical_dirty = false;
+    coordinates_dirty = false;
+    grid.clear();
+    nearest_tree.clear();
+    nearest_coords.clear();
+    nearest_pending.clear();
+    nearest_stale = 0;
+    nearest_dirty = false;
 
+    region_index.clear();
     region_IDs.clear();
-    regions.clear();
+    region_names.clear();
+    region_coords.clear();
+    region_parent.clear();
+    region_subregions.clear();
+    region_stations.clear();
+    region_depth.clear();
+    region_up.clear();
+    region_tin.clear();
+    region_tout.clear();
+    euler_order.clear();
+    euler_dirty = false;
+    region_bounds.clear();
+    region_tree_items.clear();
+    region_tree.clear();
+    region_tree_dirty = false;
+
+    train_index.clear();
+    train_IDs.clear();
+    train_stops.clear();
+    train_added.clear();
+    stop_index.clear();
+    connections.clear();
+    connections_sorted = 0;
+    connections_dirty = false;
+    connections_stale = false;
+    connections_retired = 0;
+    connection_tail.clear();
 
-    trains.clear();
+    hierarchy_rank.clear();
+    hierarchy_up_first.clear();
+    hierarchy_up.clear();
+    hierarchy_down_first.clear();
+    hierarchy_down.clear();
+    hierarchy_enabled = false;
+    hierarchy_dirty = false;
+
+    goal_directed = true;
+    heuristic_scale = 1;
+    landmark_count = 0;
+    landmark_from.clear();
+    landmark_to.clear();
+    goal_dirty = false;
+
+    station_component.clear();
+    component_lowest.clear();
+    component_cycle.clear();
+    component_reach.clear();
+    components_dirty = false;
+
+    forward_links = {};
+    backward_links = {};
+    links_dirty = false;
+
+    // The capacity is a setting rather than contents, only the entries and counters are reset
+    route_cache.clear();
+    route_cache_index.clear();
+    RouteCacheStats counts;
+    counts.capacity = route_cache_counts.capacity;
+    route_cache_counts = counts;
 }
 
 /**
  * @brief Datastructures::all_stations, get every stations IDs
  * @return all station IDs
  */
-std::vector<StationID> Datastructures::all_stations()
+std::vector<StationID> Datastructures::all_stations() const
 {
-    return station_IDs;
+    ReadLock lock(*this);
+    if(removed_count == 0){
+        return station_IDs;
+    }
+    std::vector<StationID> vector;
+    vector.reserve(station_count());
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        if(!station_removed[i]){
+            vector.push_back(station_IDs[i]);
+        }
+    }
+    return vector;
 }
 
 /**
@@ -81,15 +315,27 @@ std::vector<StationID> Datastructures::all_stations()
  * @return true if adding was successful, false if not
  */
 bool Datastructures::add_station(StationID id, const Name& name, Coord xy){
-    auto found = stations.find(id);
-    if(found != stations.end()){
+    WriteLock lock(*this);
+    StationIdx station = station_IDs.size();
+    auto inserted = station_index.insert({id, station});
+    if(!inserted.second){
        return false;
     } else {
         station_IDs.push_back(id);
-        stations[id] = Stop{name, id, nullptr, xy, NO_TIME, NO_TRAIN};
-        Stop* pointer = &stations[id];
-        alphabetical_order.push_back(pointer);
-        coordinates.push_back(pointer);
+        station_names.push_back(name);
+        station_coords.push_back(xy);
+        station_region.push_back(NO_INDEX);
+        station_region_position.push_back(NO_INDEX);
+        station_departures.emplace_back();
+        station_next.emplace_back();
+        station_previous.emplace_back();
+        station_removed.push_back(false);
+        alphabetical_order.push_back(station);
+        coordinates.push_back(station);
+        alphabetical_dirty = true;
+        coordinates_dirty = true;
+        grid_insert(station);
+        station_added(station);
         return true;
     }
 }
@@ -99,10 +345,11 @@ bool Datastructures::add_station(StationID id, const Name& name, Coord xy){
  * @param id, search key
  * @return station name if the station was found, else NO_NAME
  */
-Name Datastructures::get_station_name(StationID id){
-    auto found_id = stations.find(id);
-    if(found_id != stations.end()){
-       return found_id->second.name;
+Name Datastructures::get_station_name(StationID id) const{
+    ReadLock lock(*this);
+    StationIdx station = find_station(id);
+    if(station != NO_INDEX){
+       return station_names[station];
     } else {
         return NO_NAME;
     }
@@ -113,53 +360,123 @@ Name Datastructures::get_station_name(StationID id){
  * @param id, search key
  * @return return coordinates if the station was found, else NO_COORD;
  */
-Coord Datastructures::get_station_coordinates(StationID id){
-
-    auto found_coord = stations.find(id);
-    if(found_coord != stations.end()){
-       return found_coord->second.coords;
+Coord Datastructures::get_station_coordinates(StationID id) const{
+    ReadLock lock(*this);
+    StationIdx station = find_station(id);
+    if(station != NO_INDEX){
+       return station_coords[station];
     } else {
         return NO_COORD;
     }
 }
 
 /**
- * @brief Datastructures::stations_alphabetically, sort stations alphabetically by name
- * @return return names in sorted vector
+ * @brief distance_key, key for ordering coordinates by distance from origin
+ * @param xy, coordinates to order
+ * @return exact squared distance, ties broken by y and then x
  */
-std::vector<StationID> Datastructures::stations_alphabetically(){
-    std::vector<StationID> vector;
-    auto lambda = [](Stop* const first, Stop* const second)
-                    {return first->name < second->name;};
+std::tuple<long long, int, int> distance_key(Coord xy){
+    long long x = xy.x;
+    long long y = xy.y;
+    return {x*x + y*y, xy.y, xy.x};
+}
 
-    std::sort(alphabetical_order.begin(), alphabetical_order.end(), lambda);
-    for(auto i : alphabetical_order){
-        vector.push_back(i->SID);
+/**
+ * @brief merge_unsorted_tail, bring a partially sorted view back into order
+ * @param order, view where the first sorted elements are already in order
+ * @param sorted, size of the sorted prefix, updated to cover the whole view
+ * @param compare, ordering of the view
+ */
+template <typename Type, typename Compare>
+void merge_unsorted_tail(std::vector<Type>& order, std::size_t& sorted, Compare compare){
+    if(sorted == order.size()){
+        return;
     }
-    return vector;
+    auto middle = order.begin() + sorted;
+    std::sort(middle, order.end(), compare);
+    std::inplace_merge(order.begin(), middle, order.end(), compare);
+    sorted = order.size();
 }
 
 /**
- * @brief Datastructures::stations_distance_increasing, sort stations distance increasing
- * @return return names in sorted vector
+ * @brief Datastructures::update_alphabetical, merge new stations into the alphabetical view if needed
  */
-std::vector<StationID> Datastructures::stations_distance_increasing(){
-    auto lambda = [](Stop* const first, Stop* const second){
-        auto x = std::sqrt(std::pow(first->coords.x, 2) + std::pow(first->coords.y, 2));
-        auto y = std::sqrt(std::pow(second->coords.x, 2) + std::pow(second->coords.y, 2));
-
-        if(x == y){
-            return first->coords.y < second->coords.x;
-        } else {
-            return x < y;
+void Datastructures::update_alphabetical() const{
+    if(!alphabetical_dirty){
+        return;
+    }
+    // Readers share the lock, so another one may have rebuilt the view while this one waited
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!alphabetical_dirty){
+        return;
+    }
+    auto lambda = [this](StationIdx first, StationIdx second)
+                    {return std::tie(station_names[first], station_IDs[first])
+                            < std::tie(station_names[second], station_IDs[second]);};
+    merge_unsorted_tail(alphabetical_order, alphabetical_sorted, lambda);
+    alphabetical_IDs.clear();
+    alphabetical_IDs.reserve(alphabetical_order.size());
+    for(auto i : alphabetical_order){
+        if(!station_removed[i]){
+            alphabetical_IDs.push_back(station_IDs[i]);
         }
-    };
-    std::vector<StationID> vector;
-    std::sort(coordinates.begin(), coordinates.end(), lambda);
+    }
+    alphabetical_dirty = false;
+}
+
+/**
+ * @brief Datastructures::update_coordinates, merge new and moved stations into the distance view if needed
+ */
+void Datastructures::update_coordinates() const{
+    if(!coordinates_dirty){
+        return;
+    }
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!coordinates_dirty){
+        return;
+    }
+    if(!coordinates_moved.empty()){
+        auto moved = [this](StationIdx station){return coordinates_moved.count(station) > 0;};
+        auto sorted_end = coordinates.begin() + coordinates_sorted;
+        auto kept_end = std::remove_if(coordinates.begin(), sorted_end, moved);
+        coordinates_sorted = kept_end - coordinates.begin();
+        coordinates.erase(kept_end, sorted_end);
+        // A station added and moved before the view was merged is in the tail twice
+        std::sort(coordinates.begin() + coordinates_sorted, coordinates.end());
+        coordinates.erase(std::unique(coordinates.begin() + coordinates_sorted, coordinates.end()), coordinates.end());
+        coordinates_moved.clear();
+    }
+    auto lambda = [this](StationIdx first, StationIdx second)
+                    {return distance_key(station_coords[first]) < distance_key(station_coords[second]);};
+    merge_unsorted_tail(coordinates, coordinates_sorted, lambda);
+    coordinates_IDs.clear();
+    coordinates_IDs.reserve(coordinates.size());
     for(auto i : coordinates){
-        vector.push_back(i->SID);
+        if(!station_removed[i]){
+            coordinates_IDs.push_back(station_IDs[i]);
+        }
     }
-    return vector;
+    coordinates_dirty = false;
+}
+
+/**
+ * @brief Datastructures::stations_alphabetically, sort stations alphabetically by name
+ * @return return names in sorted vector
+ */
+std::vector<StationID> Datastructures::stations_alphabetically() const{
+    ReadLock lock(*this);
+    update_alphabetical();
+    return alphabetical_IDs;
+}
+
+/**
+ * @brief Datastructures::stations_distance_increasing, sort stations distance increasing
+ * @return return names in sorted vector
+ */
+std::vector<StationID> Datastructures::stations_distance_increasing() const{
+    ReadLock lock(*this);
+    update_coordinates();
+    return coordinates_IDs;
 }
 
 /**
@@ -167,10 +484,14 @@ std::vector<StationID> Datastructures::stations_distance_increasing(){
  * @param xy, x and y coordinates for the search
  * @return stationid if found, else NO_STATION
  */
-StationID Datastructures::find_station_with_coord(Coord xy){
-    for(auto &i : stations){
-        if(i.second.coords == xy){
-           return i.second.SID;
+StationID Datastructures::find_station_with_coord(Coord xy) const{
+    ReadLock lock(*this);
+    auto found_cell = grid.find(grid_cell(xy));
+    if(found_cell != grid.end()){
+        for(auto station : found_cell->second){
+            if(station_coords[station] == xy){
+                return station_IDs[station];
+            }
         }
     }
     return NO_STATION;
@@ -183,15 +504,55 @@ StationID Datastructures::find_station_with_coord(Coord xy){
  * @return true if changing was successful, false if not
  */
 bool Datastructures::change_station_coord(StationID id, Coord newcoord){
-    auto found_id = stations.find(id);
-    if(found_id != stations.end()){
-        found_id->second.coords = newcoord;
+    WriteLock lock(*this);
+    StationIdx station = find_station(id);
+    if(station != NO_INDEX){
+        // The station's entry in the sorted part is left where it is and dropped by the next
+        // merge, a new entry goes to the unsorted tail and gets merged into place
+        if(coordinates_moved.insert(station).second){
+            coordinates.push_back(station);
+        }
+        coordinates_dirty = true;
+
+        grid_erase(station);
+        station_coords[station] = newcoord;
+        grid_insert(station);
+        // Only the lengths of the station's own links change
+        if(!station_next[station].empty() || !station_previous[station].empty()){
+            links_changed();
+        }
         return true;
     } else {
         return false;
     }
 }
 
+/**
+ * @brief Datastructures::departure_before, order of departures within a station
+ * @param first, time and train of the first departure
+ * @param second, time and train of the second departure
+ * @return true if first leaves before second (same time ordered by train ID)
+ */
+bool Datastructures::departure_before(std::pair<Time, TrainIdx> const& first, std::pair<Time, TrainIdx> const& second) const{
+    return first.first < second.first
+            || (first.first == second.first && train_IDs[first.second] < train_IDs[second.second]);
+}
+
+/**
+ * @brief Datastructures::departure_position, find where a departure is or would be in station's departures
+ * @param station, station whose departures are searched
+ * @param time, departure time
+ * @param train, departing train
+ * @return iterator to the first departure not before (time, train)
+ */
+std::vector<std::pair<Time, Datastructures::TrainIdx>>::iterator
+Datastructures::departure_position(StationIdx station, Time time, TrainIdx train){
+    auto &departures = station_departures[station];
+    auto lambda = [this](std::pair<Time, TrainIdx> const& first, std::pair<Time, TrainIdx> const& second)
+                    {return departure_before(first, second);};
+    return std::lower_bound(departures.begin(), departures.end(), std::make_pair(time, train), lambda);
+}
+
 /**
  * @brief Datastructures::add_departure, adds new departure
  * @param stationid, for finding the right station
@@ -200,9 +561,12 @@ bool Datastructures::change_station_coord(StationID id, Coord newcoord){
  * @return true if adding was successful, false if not
  */
 bool Datastructures::add_departure(StationID stationid, TrainID trainid, Time time){
-    auto found_id = stations.find(stationid);
-    if(found_id != stations.end()){
-        found_id->second.departures.push_back(std::make_pair(time, trainid));
+    WriteLock lock(*this);
+    StationIdx station = find_station(stationid);
+    if(station != NO_INDEX){
+        TrainIdx train = intern_train(trainid);
+        station_departures[station].insert(departure_position(station, time, train), {time, train});
+        timetable_version++;
         return true;
     } else {
         return false;
@@ -217,13 +581,15 @@ bool Datastructures::add_departure(StationID stationid, TrainID trainid, Time ti
  * @return true if removing was successful, false if not
  */
 bool Datastructures::remove_departure(StationID stationid, TrainID trainid, Time time){
-    auto found_id = stations.find(stationid);
-    if(found_id != stations.end()){
-        for(auto i = found_id->second.departures.begin(); i != found_id->second.departures.end(); i++){
-            if(i->first == time && i->second == trainid){
-                found_id->second.departures.erase(i);
-                break;
-            }
+    WriteLock lock(*this);
+    StationIdx station = find_station(stationid);
+    if(station != NO_INDEX){
+        auto found_train = train_index.find(trainid);
+        if(found_train == train_index.end()){
+            return true;
+        }
+        if(erase_departure(station, time, found_train->second)){
+            timetable_version++;
         }
         return true;
     } else {
@@ -231,21 +597,41 @@ bool Datastructures::remove_departure(StationID stationid, TrainID trainid, Time
     }
 }
 
+/**
+ * @brief Datastructures::erase_departure, remove one departure from a station's departures
+ * @param station, station the train leaves from
+ * @param time, departure time
+ * @param train, leaving train
+ * @return true if the departure was there
+ */
+bool Datastructures::erase_departure(StationIdx station, Time time, TrainIdx train){
+    auto found_departure = departure_position(station, time, train);
+    if(found_departure != station_departures[station].end() && *found_departure == std::make_pair(time, train)){
+        station_departures[station].erase(found_departure);
+        return true;
+    }
+    return false;
+}
+
 /**
  * @brief Datastructures::station_departures_after, list departures by time
  * @param stationid for finding the right station
  * @param time, list trains leaving after given time
- * @return vector of leaving trains, if no trains leaving return NO_TIME, NO_TRAIN in a vector
+ * @return vector of leaving trains in time order, if no trains leaving return NO_TIME, NO_TRAIN in a vector
  */
-std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(StationID stationid, Time time){
-    auto found_id = stations.find(stationid);
-    if(found_id != stations.end()){
-        // Trains leaving at given time are saved in this temp. vector
+std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(StationID stationid, Time time) const{
+    ReadLock lock(*this);
+    StationIdx station = find_station(stationid);
+    if(station != NO_INDEX){
+        auto &departures = station_departures[station];
+        // Departures are sorted, so the ones leaving at given time or later are a contiguous range
+        auto first = std::lower_bound(departures.begin(), departures.end(), time,
+                                      [](std::pair<Time, TrainIdx> const& departure, Time value)
+                                        {return departure.first < value;});
         std::vector<std::pair<Time, TrainID>> vector;
-        for(auto i = found_id->second.departures.begin(); i != found_id->second.departures.end(); i++){
-            if(i->first >= time){
-                vector.push_back(std::make_pair(i->first, i->second));
-            }
+        vector.reserve(departures.end() - first);
+        for(auto i = first; i != departures.end(); i++){
+            vector.push_back({i->first, train_IDs[i->second]});
         }
         return vector;
     } else {
@@ -261,22 +647,34 @@ std::vector<std::pair<Time, TrainID>> Datastructures::station_departures_after(S
  * @return true if adding was successful, false if not
  */
 bool Datastructures::add_region(RegionID id, const Name &name, std::vector<Coord> coords){
-    auto found = regions.find(id);
-    if(found != regions.end()){
+    WriteLock lock(*this);
+    auto inserted = region_index.insert({id, static_cast<RegionIdx>(region_IDs.size())});
+    if(!inserted.second){
         return false;
     } else {
         region_IDs.push_back(id);
-        regions[id] = Region{name, id, coords};
+        region_names.push_back(name);
+        region_bounds.push_back(bounding_box(coords));
+        region_tree_dirty = true;
+        region_coords.push_back(std::move(coords));
+        region_parent.push_back(NO_INDEX);
+        region_subregions.emplace_back();
+        region_stations.emplace_back();
+        region_depth.push_back(0);
+        for(auto &level : region_up){
+            level.push_back(NO_INDEX);
+        }
+        euler_dirty = true;
         return true;
     }
-    return true;
 }
 
 /**
  * @brief Datastructures::all_regions, get every region IDs
  * @return region IDs in a vector
  */
-std::vector<RegionID> Datastructures::all_regions(){
+std::vector<RegionID> Datastructures::all_regions() const{
+    ReadLock lock(*this);
     return region_IDs;
 }
 
@@ -285,10 +683,11 @@ std::vector<RegionID> Datastructures::all_regions(){
  * @param id, id for finding the wanted region
  * @return region name if the region was found, else return NO_NAME
  */
-Name Datastructures::get_region_name(RegionID id){
-    auto found_id = regions.find(id);
-    if(found_id != regions.end()){
-       return found_id->second.name;
+Name Datastructures::get_region_name(RegionID id) const{
+    ReadLock lock(*this);
+    RegionIdx region = find_region(id);
+    if(region != NO_INDEX){
+       return region_names[region];
     } else {
         return NO_NAME;
     }
@@ -299,10 +698,11 @@ Name Datastructures::get_region_name(RegionID id){
  * @param id, id for finding the wanted region
  * @return vector, coordinates if the region was found, else return NO_COORD in a vector
  */
-std::vector<Coord> Datastructures::get_region_coords(RegionID id){
-    auto found_coord = regions.find(id);
-    if(found_coord != regions.end()){
-        return found_coord->second.coords;
+std::vector<Coord> Datastructures::get_region_coords(RegionID id) const{
+    ReadLock lock(*this);
+    RegionIdx region = find_region(id);
+    if(region != NO_INDEX){
+        return region_coords[region];
     } else {
         return {NO_COORD};
     }
@@ -315,16 +715,22 @@ std::vector<Coord> Datastructures::get_region_coords(RegionID id){
  * @return true if adding was successful, false if not
  */
 bool Datastructures::add_subregion_to_region(RegionID id, RegionID parentid){
-    auto found_region = regions.find(id);
-    auto found_parent = regions.find(parentid);
-    if(found_region == regions.end() || found_parent == regions.end()
-            || found_region->second.parentreg != nullptr){
+    WriteLock lock(*this);
+    RegionIdx region = find_region(id);
+    RegionIdx parent = find_region(parentid);
+    if(region == NO_INDEX || parent == NO_INDEX || region_parent[region] != NO_INDEX){
+        return false;
+    }
+    // A region can't become a subregion of its own subregion
+    if(region_depth[parent] >= region_depth[region]
+            && region_ancestor(parent, region_depth[parent] - region_depth[region]) == region){
         return false;
-    } else {
-        found_region->second.parentreg = &found_parent->second;
-        found_parent->second.subregions.push_back(id);
-        return true;
     }
+    region_parent[region] = parent;
+    region_subregions[parent].push_back(region);
+    update_region_ancestry(region);
+    euler_dirty = true;
+    return true;
 }
 
 /**
@@ -334,14 +740,15 @@ bool Datastructures::add_subregion_to_region(RegionID id, RegionID parentid){
  * @return true if adding was successful, false if not
  */
 bool Datastructures::add_station_to_region(StationID id, RegionID parentid){
-    auto found_station = stations.find(id);
-    auto found_region = regions.find(parentid);
-    if((found_station == stations.end() || found_region == regions.end())
-            || found_station->second.RID != nullptr){
+    WriteLock lock(*this);
+    StationIdx station = find_station(id);
+    RegionIdx region = find_region(parentid);
+    if(station == NO_INDEX || region == NO_INDEX || station_region[station] != NO_INDEX){
         return false;
     } else {
-        found_station->second.RID = &found_region->second;
-        found_region->second.stations.push_back(&stations.at(id));
+        station_region[station] = region;
+        station_region_position[station] = region_stations[region].size();
+        region_stations[region].push_back(station);
         return true;
     }
 }
@@ -351,257 +758,3591 @@ bool Datastructures::add_station_to_region(StationID id, RegionID parentid){
  * @param id, id for finding the wanted station
  * @return vector, where all regions are listed, if no regions are found return NO_REGION
  */
-std::vector<RegionID> Datastructures::station_in_regions(StationID id){
+std::vector<RegionID> Datastructures::station_in_regions(StationID id) const{
+    ReadLock lock(*this);
     std::vector<RegionID> vector;
-    auto found_id = stations.find(id);
+    StationIdx station = find_station(id);
     // Check if station ID exists
-    if(found_id != stations.end()){
-        // Check if station doesn't belong to any regions
-        if(found_id->second.RID == nullptr){
-            return {};
-        } else {
-            auto temp = found_id->second.RID;
-            while(temp != nullptr){
-                vector.push_back(temp->RID);
-                temp = temp->parentreg;
-            }
-            return vector;
+    if(station != NO_INDEX){
+        // Regions are walked up to the root, station without a region gives an empty vector
+        for(auto region = station_region[station]; region != NO_INDEX; region = region_parent[region]){
+            vector.push_back(region_IDs[region]);
         }
+        return vector;
     } else {
         return {NO_REGION};
     }
 }
 
-std::vector<RegionID> Datastructures::all_subregions_of_region(RegionID /*id*/){
-    // Replace the line below with your implementation
-    // Also uncomment parameters (/* param */ -> param)
-    throw NotImplemented("all_subregions_of_region()");
+/**
+ * @brief Datastructures::regions_containing, list the regions whose polygon contains given coordinates
+ * @param xy, coordinates to look up
+ * @return innermost region containing xy and all its parent regions, empty vector if no region contains xy
+ */
+std::vector<RegionID> Datastructures::regions_containing(Coord xy) const{
+    ReadLock lock(*this);
+    update_region_tree();
+    if(region_tree.empty()){
+        return {};
+    }
+    auto box_contains = [xy](BoxNode const& box){
+        return box.low.x <= xy.x && xy.x <= box.high.x && box.low.y <= xy.y && xy.y <= box.high.y;
+    };
+    // Regions whose bounding box contains xy, found by walking down the R-tree
+    std::vector<RegionIdx> candidates;
+    std::vector<std::pair<std::size_t, unsigned int>> stack;
+    for(unsigned int i = 0; i < region_tree.back().size(); i++){
+        stack.push_back({region_tree.size() - 1, i});
+    }
+    while(!stack.empty()){
+        auto [level, index] = stack.back();
+        stack.pop_back();
+        auto &node = region_tree[level][index];
+        if(!box_contains(node)){
+            continue;
+        }
+        for(auto i = node.first; i < node.first + node.count; i++){
+            if(level > 0){
+                stack.push_back({level - 1, i});
+            } else if(box_contains(region_bounds[region_tree_items[i]])){
+                candidates.push_back(region_tree_items[i]);
+            }
+        }
+    }
+    // Deepest region first, the first polygon that contains xy gives the whole chain
+    std::sort(candidates.begin(), candidates.end(), [this](RegionIdx first, RegionIdx second)
+                {return std::make_pair(region_depth[second], first) < std::make_pair(region_depth[first], second);});
+    for(auto region : candidates){
+        if(polygon_contains(region, xy)){
+            std::vector<RegionID> vector;
+            for(; region != NO_INDEX; region = region_parent[region]){
+                vector.push_back(region_IDs[region]);
+            }
+            return vector;
+        }
+    }
+    return {};
 }
 
-std::vector<StationID> Datastructures::stations_closest_to(Coord /*xy*/){
-    // Replace the line below with your implementation
-    // Also uncomment parameters (/* param */ -> param)
-    throw NotImplemented("stations_closest_to()");
+/**
+ * @brief Datastructures::polygon_contains, point in polygon test
+ * @param region, region whose polygon is tested
+ * @param xy, point to test
+ * @return true if xy is inside the polygon or on its edge
+ */
+bool Datastructures::polygon_contains(RegionIdx region, Coord xy) const{
+    auto &polygon = region_coords[region];
+    std::size_t count = polygon.size();
+    if(count < 3){
+        return false;
+    }
+    long long px = xy.x;
+    long long py = xy.y;
+    // Crossing number: count edges crossing the horizontal ray to the right of xy. The loop
+    // has no early exits so that the compiler can vectorize it.
+    unsigned int crossings = 0;
+    unsigned int on_edge = 0;
+    for(std::size_t i = 0, j = count - 1; i < count; j = i++){
+        long long xi = polygon[i].x, yi = polygon[i].y;
+        long long xj = polygon[j].x, yj = polygon[j].y;
+        long long cross = (xj - xi) * (py - yi) - (yj - yi) * (px - xi);
+        on_edge += cross == 0 && std::min(xi, xj) <= px && px <= std::max(xi, xj)
+                              && std::min(yi, yj) <= py && py <= std::max(yi, yj);
+        // The edge straddles the ray's y, then xy is left of the edge if cross has the edge's sign
+        bool straddles = (yi > py) != (yj > py);
+        crossings += straddles && ((cross > 0) == (yj > yi));
+    }
+    return on_edge > 0 || (crossings & 1);
 }
 
-bool Datastructures::remove_station(StationID /*id*/){
-    // Replace the line below with your implementation
-    // Also uncomment parameters (/* param */ -> param)
-    throw NotImplemented("remove_station()");
+/**
+ * @brief Datastructures::bounding_box, smallest box containing all given coordinates
+ * @param coords, polygon corners
+ * @return the box, NO_COORD corners if coords is empty
+ */
+Datastructures::BoxNode Datastructures::bounding_box(std::vector<Coord> const& coords){
+    BoxNode box{coords.empty() ? NO_COORD : coords.front(), coords.empty() ? NO_COORD : coords.front(), 0, 0};
+    for(auto &xy : coords){
+        box.low = {std::min(box.low.x, xy.x), std::min(box.low.y, xy.y)};
+        box.high = {std::max(box.high.x, xy.x), std::max(box.high.y, xy.y)};
+    }
+    return box;
 }
 
 /**
- * @brief Datastructures::common_parent_of_regions, find the common parent of two stations
- * @param id1, for finding the right station and its parent regions
- * @param id2, for finding the right station and its parent regions
- * @return if found common parent ID, else NO_REGION
+ * @brief Datastructures::update_region_tree, rebuild the R-tree of region bounding boxes if regions were added
  */
-RegionID Datastructures::common_parent_of_regions(RegionID id1, RegionID id2){
-    auto found_id1 = regions.find(id1);
-    auto found_id2 = regions.find(id2);
-    if(found_id1 == regions.end() && found_id2 == regions.end()){
-       return NO_REGION;
+void Datastructures::update_region_tree() const{
+    if(!region_tree_dirty){
+        return;
     }
-    if(found_id1->second.parentreg == found_id2->second.parentreg){
-        return found_id1->second.RID;
-    } else {
-        std::vector<RegionID> temp;
-        Region* parent_reg = found_id1->second.parentreg;
-        while(parent_reg != nullptr){
-            temp.push_back(parent_reg->RID);
-            parent_reg = parent_reg->parentreg;
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!region_tree_dirty){
+        return;
+    }
+    unsigned int const node_size = 16;
+    region_tree.clear();
+    region_tree_items.clear();
+    for(RegionIdx i = 0; i < region_IDs.size(); i++){
+        if(region_coords[i].size() >= 3){
+            region_tree_items.push_back(i);
         }
-        parent_reg = found_id2->second.parentreg;
-        while(parent_reg != nullptr){
-            if(std::find(temp.begin(), temp.end(), parent_reg->RID) != temp.end()){
-                return parent_reg->RID;
+    }
+    // Sort-tile-recursive packing: slices by x, each slice by y, then groups of node_size
+    auto center_x = [this](RegionIdx region){return static_cast<long long>(region_bounds[region].low.x) + region_bounds[region].high.x;};
+    auto center_y = [this](RegionIdx region){return static_cast<long long>(region_bounds[region].low.y) + region_bounds[region].high.y;};
+    std::size_t items = region_tree_items.size();
+    std::size_t leaves = (items + node_size - 1) / node_size;
+    std::size_t slice = node_size * static_cast<std::size_t>(std::ceil(std::sqrt(static_cast<double>(leaves))));
+    std::sort(region_tree_items.begin(), region_tree_items.end(),
+              [&center_x](RegionIdx first, RegionIdx second){return center_x(first) < center_x(second);});
+    for(std::size_t begin = 0; begin < items; begin += slice){
+        auto end = region_tree_items.begin() + std::min(begin + slice, items);
+        std::sort(region_tree_items.begin() + begin, end,
+                  [&center_y](RegionIdx first, RegionIdx second){return center_y(first) < center_y(second);});
+    }
+    // Build levels bottom up until one level fits into a single node
+    auto make_level = [node_size](std::size_t count, auto box_of){
+        std::vector<BoxNode> level;
+        for(std::size_t begin = 0; begin < count; begin += node_size){
+            BoxNode node = box_of(begin);
+            node.first = begin;
+            node.count = std::min<std::size_t>(node_size, count - begin);
+            for(auto i = begin + 1; i < begin + node.count; i++){
+                BoxNode box = box_of(i);
+                node.low = {std::min(node.low.x, box.low.x), std::min(node.low.y, box.low.y)};
+                node.high = {std::max(node.high.x, box.high.x), std::max(node.high.y, box.high.y)};
             }
+            level.push_back(node);
+        }
+        return level;
+    };
+    if(items > 0){
+        region_tree.push_back(make_level(items, [this](std::size_t i){return region_bounds[region_tree_items[i]];}));
+        while(region_tree.back().size() > node_size){
+            auto &below = region_tree.back();
+            region_tree.push_back(make_level(below.size(), [&below](std::size_t i){return below[i];}));
         }
     }
-    return NO_REGION;
+    region_tree_dirty = false;
 }
 
 /**
- * @brief Datastructures::add_train add train into the datastructure
- * @param trainid individual train ID
- * @param stationtimes vector pair of station ID and time the train travels
- * @return return true if adding was successful
+ * @brief Datastructures::all_subregions_of_region, list all direct and indirect subregions
+ * @param id, id for finding the wanted region
+ * @return vector of subregions, if the region is not found return NO_REGION in a vector
  */
-bool Datastructures::add_train(TrainID trainid, std::vector<std::pair<StationID, Time>> stationtimes){
-    auto found_train = trains.find(trainid);
-    if(found_train != trains.end()){
-        return false;
-    } else {
-        std::vector<Stop*> temp_stations = {};
-        // käy läpi kaikki asemat
-        for(auto &i : stationtimes){
-            auto found_SID = stations.find(i.first);
-            // jos jokin asema ei löydy return false, muuten lisää temp vektoriin pointteri minne juna kulkee
-            if(found_SID == stations.end()){
-                return false;
-            } else {
-                temp_stations.push_back(&found_SID->second);
-            }
-        }
-        // lisätään uusi juna mappiin
-        trains[trainid] = stationtimes;
-        //
-        for(unsigned int i = 0;i < temp_stations.size() - 1; i++){
-            temp_stations[i]->departures.push_back({stationtimes[i].second, trainid});
-            temp_stations[i]->neighbours[trainid] = temp_stations[i+1];
-        }
-        temp_stations.back()->departures.push_back({stationtimes.back().second, trainid});
-        return true;
+std::vector<RegionID> Datastructures::all_subregions_of_region(RegionID id) const{
+    ReadLock lock(*this);
+    RegionIdx region = find_region(id);
+    if(region == NO_INDEX){
+        return {NO_REGION};
     }
+    update_euler_tour();
+    std::vector<RegionID> vector;
+    vector.reserve(region_tout[region] - region_tin[region] - 1);
+    for(auto i = region_tin[region] + 1; i < region_tout[region]; i++){
+        vector.push_back(region_IDs[euler_order[i]]);
+    }
+    return vector;
 }
+
 /**
- * @brief Datastructures::next_stations_from return all following stations
- * @param id key to find wanted station where to search from
- * @return return vector of stations
+ * @brief Datastructures::is_subregion_of, check if region is directly or indirectly inside another
+ * @param id, region that may be inside
+ * @param parentid, region that may contain it
+ * @return true if id is a subregion of parentid, false if not or either region is not found
  */
-std::vector<StationID> Datastructures::next_stations_from(StationID id){
-    auto found_station = stations.find(id);
-    if(found_station == stations.end()){
-        return {NO_STATION};
-    } else {
-        std::vector<StationID> temp;
-        for(auto &i : found_station->second.neighbours){
-            temp.push_back(i.second->SID);
-        }
-        return temp;
+bool Datastructures::is_subregion_of(RegionID id, RegionID parentid) const{
+    ReadLock lock(*this);
+    RegionIdx region = find_region(id);
+    RegionIdx parent = find_region(parentid);
+    if(region == NO_INDEX || parent == NO_INDEX){
+        return false;
     }
+    update_euler_tour();
+    return region_tin[parent] < region_tin[region] && region_tin[region] < region_tout[parent];
 }
 
 /**
- * @brief Datastructures::train_stations_from list of stations train will pass on its' way
- * @param stationid the starting station
- * @param trainid the train which path we want to follow
- * @return
+ * @brief Datastructures::stations_closest_to, find the three stations closest to given coordinates
+ * @param xy, coordinates where the distance is measured from
+ * @return vector of at most three stations, closest first (ties broken by smaller y)
  */
-std::vector<StationID> Datastructures::train_stations_from(StationID stationid, TrainID trainid){
-    auto found_SID = stations.find(stationid);
-    auto found_TID = trains.find(trainid);
-    if(found_SID == stations.end() || found_TID == trains.end()){
-        return {NO_STATION};
-    } else {
-        auto iter = found_SID->second.neighbours.find(trainid);
-        if(iter == found_SID->second.neighbours.end()){
-            return {NO_STATION};
+std::vector<StationID> Datastructures::stations_closest_to(Coord xy) const{
+    ReadLock lock(*this);
+    update_nearest();
+    unsigned int const wanted = 3;
+    // Squared distance, y and x, so that ties are broken the same way every time
+    using Key = std::tuple<long long, int, int>;
+    // Kept sorted, so best.back() is always the worst of the candidates
+    std::vector<std::pair<Key, StationIdx>> best;
+    auto square = [](long long value){
+        return value * value;
+    };
+    auto offer = [&](StationIdx station, Coord coords){
+        Key key{square(coords.x - static_cast<long long>(xy.x)) + square(coords.y - static_cast<long long>(xy.y)),
+                coords.y, coords.x};
+        if(best.size() == wanted && !(key < best.back().first)){
+            return;
         }
-        std::vector<StationID> temp;
-        auto current_station = iter->second;
-        while(iter->second){
-            temp.push_back(iter->second->SID);
-            iter = iter->second->neighbours.find(trainid);
-            if(iter == current_station->neighbours.end()){
-                break;
+        // A station moved back to where it was can be both in the tree and pending
+        for(auto &candidate : best){
+            if(candidate.second == station){
+                return;
             }
-            current_station = iter->second;
         }
-        return temp;
+        auto position = std::upper_bound(best.begin(), best.end(), key,
+                                         [](Key const& first, std::pair<Key, StationIdx> const& second)
+                                         {return first < second.first;});
+        best.insert(position, {key, station});
+        if(best.size() > wanted){
+            best.pop_back();
+        }
+    };
+
+    // Ranges of the tree still to search: lo, hi, depth and squared distance to the range
+    std::vector<std::tuple<std::size_t, std::size_t, unsigned int, long long>> stack;
+    stack.push_back({0, nearest_tree.size(), 0, 0});
+    while(!stack.empty()){
+        auto [lo, hi, depth, bound] = stack.back();
+        stack.pop_back();
+        // Equal distance is still searched, the tie breaker may prefer the station there
+        if(lo >= hi || (best.size() == wanted && bound > std::get<0>(best.back().first))){
+            continue;
+        }
+        std::size_t middle = (lo + hi) / 2;
+        Coord split = nearest_coords[middle];
+        StationIdx station = nearest_tree[middle];
+        if(!station_removed[station] && station_coords[station] == split){
+            offer(station, split);
+        }
+        long long difference = depth % 2 == 0 ? static_cast<long long>(xy.x) - split.x
+                                               : static_cast<long long>(xy.y) - split.y;
+        // The near side is pushed last so that it is searched first
+        if(difference < 0){
+            stack.push_back({middle + 1, hi, depth + 1, std::max(bound, square(difference))});
+            stack.push_back({lo, middle, depth + 1, bound});
+        } else {
+            stack.push_back({lo, middle, depth + 1, std::max(bound, square(difference))});
+            stack.push_back({middle + 1, hi, depth + 1, bound});
+        }
+    }
+    for(auto station : nearest_pending){
+        if(!station_removed[station]){
+            offer(station, station_coords[station]);
+        }
+    }
+
+    std::vector<StationID> vector;
+    for(auto &i : best){
+        vector.push_back(station_IDs[i.second]);
     }
+    return vector;
 }
 
 /**
- * @brief Datastructures::clear_trains clear datastructures
+ * @brief Datastructures::remove_station, remove station and its departures
+ * @param id, id of the station to remove
+ * @return true if removing was successful, false if there is no such station
  */
-void Datastructures::clear_trains(){
-    trains.clear();
-    for(auto &i : stations){
-        i.second.departures.clear();
-        i.second.neighbours.clear();
+bool Datastructures::remove_station(StationID id){
+    WriteLock lock(*this);
+    StationIdx station = find_station(id);
+    if(station == NO_INDEX){
+        return false;
+    }
+    // Trains stopping at the station skip it from now on. A stop of a train with other stops
+    // has a link, a train stopping only here is found from its departure unless that was removed.
+    std::vector<TrainIdx> passing;
+    for(auto &link : station_next[station]){
+        passing.push_back(link.first);
+    }
+    for(auto &link : station_previous[station]){
+        passing.push_back(link.first);
+    }
+    for(auto &departure : station_departures[station]){
+        if(train_added[departure.second]){
+            passing.push_back(departure.second);
+        }
+    }
+    std::sort(passing.begin(), passing.end());
+    passing.erase(std::unique(passing.begin(), passing.end()), passing.end());
+    // A train stopping here between two other stops gets a link straight between them
+    bool bridged = false;
+    for(auto train : passing){
+        auto stops = train_stops[train];
+        for(std::size_t i = 1; i + 1 < stops.size(); i++){
+            bridged = bridged || stops[i].first == station;
+        }
+        stops.erase(std::remove_if(stops.begin(), stops.end(),
+                                   [station](std::pair<StationIdx, Time> const& stop){return stop.first == station;}),
+                    stops.end());
+        relink_train(train, std::move(stops));
+    }
+    station_departures[station].clear();
+    station_next[station].clear();
+    station_previous[station].clear();
+    if(!passing.empty()){
+        link_version++;
+        timetable_version++;
+        // Routes only get longer without the station, except along a bridging link, which can
+        // be shorter than the two links it replaces. Components stay valid either way, as the
+        // bridging link doesn't reach anything the station didn't.
+        hierarchy_dirty = true;
+        goal_dirty = goal_dirty || bridged;
+    }
+
+    if(station_region[station] != NO_INDEX){
+        // The last station of the region takes the removed one's place
+        auto &members = region_stations[station_region[station]];
+        StationIdx moved = members.back();
+        members[station_region_position[station]] = moved;
+        station_region_position[moved] = station_region_position[station];
+        members.pop_back();
+        station_region[station] = NO_INDEX;
+        station_region_position[station] = NO_INDEX;
+    }
+    grid_erase(station);
+    station_index.erase(id);
+    // Sorted views keep the slot, it is skipped when the listings are rebuilt
+    station_removed[station] = true;
+    removed_count++;
+    alphabetical_dirty = true;
+    coordinates_dirty = true;
+
+    // Compacting once half of the slots are removed keeps removal amortized constant
+    if(removed_count * 2 > station_IDs.size()){
+        compact_stations();
     }
+    return true;
 }
 
 /**
- * @brief distance calculate distance between two points
- * @param a the first point
- * @param b the second point
- * @return return the calculated distance
+ * @brief Datastructures::unlink_train, take the links, stop index entries and connections of a train out
+ * @param train, train whose stops stay in train_stops for the caller
  */
-int distance(Coord a, Coord b){
-    return trunc(sqrt(pow(a.x-b.x,2)+pow(a.y-b.y,2)));
+void Datastructures::unlink_train(TrainIdx train){
+    auto is_train = [train](std::pair<TrainIdx, StationIdx> const& link){return link.first == train;};
+    unindex_stops(train);
+    retire_connections(train);
+    for(auto &stop : train_stops[train]){
+        auto &links = station_next[stop.first];
+        links.erase(std::remove_if(links.begin(), links.end(), is_train), links.end());
+        auto &back_links = station_previous[stop.first];
+        back_links.erase(std::remove_if(back_links.begin(), back_links.end(), is_train), back_links.end());
+    }
 }
 
 /**
- * @brief Datastructures::route_any return some path between two stations
- * @param fromid station where to start the search
- * @param toid station where to stop the search
- * @return return all stations in order and the overall distance
+ * @brief Datastructures::relink_train, replace the stops of a train with some of them and rebuild its links
+ * @param train, train whose route changes
+ * @param stops, new stations and times of the train, the old stops in the same order with some left out
  */
-std::vector<std::pair<StationID, Distance>> Datastructures::route_any(StationID fromid, StationID toid){
-    auto found_station = stations.find(fromid);
-    auto found_station2 = stations.find(toid);
-    if(found_station == stations.end() || found_station2 == stations.end()){
-        return {{NO_STATION,NO_DISTANCE}};
+void Datastructures::relink_train(TrainIdx train, std::vector<std::pair<StationIdx, Time>> stops){
+    unlink_train(train);
+    for(std::size_t i = 0; i + 1 < stops.size(); i++){
+        station_next[stops[i].first].push_back({train, stops[i+1].first});
+        station_previous[stops[i+1].first].push_back({train, stops[i].first});
     }
-    // Set pointers to nullptr so we know when we are at the first station in reverse order
-    found_station->second.previous = nullptr;
-    found_station2->second.previous = nullptr;
-
-    std::vector<std::pair<StationID, Distance>> temp;
-    // BFS
-    std::queue<Stop*> que;
-    std::unordered_set<StationID> visited_nodes;
-    visited_nodes.insert(found_station->second.SID);
-    que.push(&found_station->second);
-    while(!que.empty()){
-        Stop* current_node = que.front();
-        que.pop();
-        for(auto &[trainID, stop] : current_node->neighbours){
-            auto not_visited = visited_nodes.insert(stop->SID).second;
-            if(not_visited == true){
-                que.push(stop);
-                stop->previous = current_node;
-                if(stop == &found_station2->second){
-                    while(!que.empty()){
-                        que.pop();
-                    }
-                    break;
-                }
-            }
+    // The search graph is patched row by row unless it is going to be rebuilt anyway. Leaving
+    // stops out never gives a station more links of the train, so the new ones fit in its row.
+    if(!links_dirty){
+        for(auto &stop : train_stops[train]){
+            forward_links.replace_train(stop.first, train, station_next[stop.first], station_coords);
+            backward_links.replace_train(stop.first, train, station_previous[stop.first], station_coords);
         }
     }
-    if(found_station2->second.previous == nullptr){
-       return temp;
-    }
-    std::vector<std::pair<StationID, Distance>> reverse_route;
-    int sum = 0;
-    auto prev_station = &found_station2->second;
-    while(prev_station->previous != nullptr){
-        reverse_route.push_back({prev_station->SID,
-                        distance(prev_station->coords, prev_station->previous->coords)});
-        prev_station = prev_station->previous;
-    }
-    reverse_route.push_back({prev_station->SID, 0});
-    temp.reserve(reverse_route.size());
-    for(auto i = reverse_route.rbegin(); i != reverse_route.rend(); i++){
-        sum += i->second;
-        temp.push_back({i->first, sum});
-    }
-    return temp;
+    train_stops[train] = std::move(stops);
+    index_stops(train);
+    append_connections(train);
 }
 
-
-std::vector<std::pair<StationID, Distance>> Datastructures::route_least_stations(StationID fromid, StationID toid){
-    return route_any(fromid, toid);
+/**
+ * @brief Datastructures::stop_key, key of a station and a train in stop_index
+ * @param station, station of the stop
+ * @param train, train stopping there
+ * @return both indexes packed into one number
+ */
+std::uint64_t Datastructures::stop_key(StationIdx station, TrainIdx train){
+    return (static_cast<std::uint64_t>(station) << 32) | train;
 }
 
-std::vector<StationID> Datastructures::route_with_cycle(StationID /*fromid*/){
-    // Replace the line below with your implementation
-    // Also uncomment parameters ( /* param */ -> param )
-    throw NotImplemented("route_with_cycle()");
+/**
+ * @brief Datastructures::index_stops, add the stops of a train to stop_index
+ * @param train, train whose stops are added, a station visited twice keeps the first visit
+ */
+void Datastructures::index_stops(TrainIdx train){
+    auto &stops = train_stops[train];
+    for(unsigned int i = 0; i < stops.size(); i++){
+        stop_index.emplace(stop_key(stops[i].first, train), i);
+    }
 }
 
-std::vector<std::pair<StationID, Distance>> Datastructures::route_shortest_distance(StationID /*fromid*/, StationID /*toid*/){
-    // Replace the line below with your implementation
-    // Also uncomment parameters ( /* param */ -> param )
-    throw NotImplemented("route_shortest_distance()");
+/**
+ * @brief Datastructures::unindex_stops, remove the stops of a train from stop_index
+ * @param train, train whose stops are removed
+ */
+void Datastructures::unindex_stops(TrainIdx train){
+    for(auto &stop : train_stops[train]){
+        stop_index.erase(stop_key(stop.first, train));
+    }
 }
 
-std::vector<std::pair<StationID, Time>> Datastructures::route_earliest_arrival(StationID /*fromid*/, StationID /*toid*/, Time /*starttime*/)
+/**
+ * @brief Datastructures::compact_stations, reclaim the slots of removed stations
+ */
+void Datastructures::compact_stations(){
+    WriteLock lock(*this);
+    if(removed_count == 0){
+        return;
+    }
+    // Links of stations in use must not lead to removed ones, they would be remapped to nothing
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        if(station_removed[i]){
+            continue;
+        }
+        for(auto &link : station_next[i]){
+            if(station_removed[link.second]){
+                throw std::logic_error("compact_stations(): link to a removed station");
+            }
+        }
+        for(auto &link : station_previous[i]){
+            if(station_removed[link.second]){
+                throw std::logic_error("compact_stations(): link from a removed station");
+            }
+        }
+    }
+    // Moved stations have two entries in the distance view, merging it first leaves one per station
+    update_coordinates();
+    // New index of every station that is still in use
+    std::vector<StationIdx> remap(station_IDs.size(), NO_INDEX);
+    StationIdx next = 0;
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        if(!station_removed[i]){
+            remap[i] = next;
+            if(next == i){
+                next++;
+                continue;
+            }
+            station_IDs[next] = std::move(station_IDs[i]);
+            station_names[next] = std::move(station_names[i]);
+            station_coords[next] = station_coords[i];
+            station_region[next] = station_region[i];
+            station_region_position[next] = station_region_position[i];
+            station_departures[next] = std::move(station_departures[i]);
+            station_next[next] = std::move(station_next[i]);
+            station_previous[next] = std::move(station_previous[i]);
+            next++;
+        }
+    }
+    station_IDs.resize(next);
+    station_names.resize(next);
+    station_coords.resize(next);
+    station_region.resize(next);
+    station_region_position.resize(next);
+    station_departures.resize(next);
+    station_next.resize(next);
+    station_previous.resize(next);
+    station_removed.assign(next, false);
+    removed_count = 0;
+
+    for(auto &links : station_next){
+        for(auto &link : links){
+            link.second = remap[link.second];
+        }
+    }
+    for(auto &links : station_previous){
+        for(auto &link : links){
+            link.second = remap[link.second];
+        }
+    }
+    for(auto &stops : train_stops){
+        // A train that only stopped at a removed station and had its departure removed keeps no stop there
+        stops.erase(std::remove_if(stops.begin(), stops.end(),
+                                   [&remap](std::pair<StationIdx, Time> const& stop){return remap[stop.first] == NO_INDEX;}),
+                    stops.end());
+        for(auto &stop : stops){
+            stop.first = remap[stop.first];
+        }
+    }
+    stop_index.clear();
+    for(TrainIdx train = 0; train < train_stops.size(); train++){
+        index_stops(train);
+    }
+    connections_stale = true;
+    connections_dirty = true;
+    links_changed();
+    for(auto &members : region_stations){
+        for(auto &member : members){
+            member = remap[member];
+        }
+    }
+    for(auto &entry : station_index){
+        entry.second = remap[entry.second];
+    }
+    for(auto &cell : grid){
+        for(auto &member : cell.second){
+            member = remap[member];
+        }
+    }
+    // Station indexes changed, the next query rebuilds the nearest station tree
+    nearest_dirty = true;
+    // Removing entries keeps the relative order, so the sorted prefixes stay sorted
+    auto compact_order = [&remap](std::vector<StationIdx>& order, std::size_t& sorted){
+        std::size_t kept = 0;
+        std::size_t kept_sorted = 0;
+        for(std::size_t i = 0; i < order.size(); i++){
+            if(remap[order[i]] != NO_INDEX){
+                order[kept++] = remap[order[i]];
+                if(i < sorted){
+                    kept_sorted++;
+                }
+            }
+        }
+        order.resize(kept);
+        sorted = kept_sorted;
+    };
+    compact_order(alphabetical_order, alphabetical_sorted);
+    compact_order(coordinates, coordinates_sorted);
+}
+
+/**
+ * @brief Datastructures::common_parent_of_regions, find the nearest region having both regions as subregions
+ * @param id1, first region
+ * @param id2, second region
+ * @return if found common parent ID, else NO_REGION
+ */
+RegionID Datastructures::common_parent_of_regions(RegionID id1, RegionID id2) const{
+    ReadLock lock(*this);
+    RegionIdx region1 = find_region(id1);
+    RegionIdx region2 = find_region(id2);
+    if(region1 == NO_INDEX || region2 == NO_INDEX){
+       return NO_REGION;
+    }
+    RegionIdx common = lowest_common_region(region1, region2);
+    // If one region is inside the other, the common parent is above both of them
+    if(common == region1 || common == region2){
+        common = region_parent[common];
+    }
+    if(common == NO_INDEX){
+        return NO_REGION;
+    }
+    return region_IDs[common];
+}
+
+/**
+ * @brief Datastructures::update_region_ancestry, recompute depths and ancestor tables for a subtree
+ * @param root, region whose parent has changed, its whole subtree is updated
+ */
+void Datastructures::update_region_ancestry(RegionIdx root){
+    // Subtree in top down order, so that ancestors are always updated first
+    std::vector<RegionIdx> subtree = {root};
+    for(std::size_t i = 0; i < subtree.size(); i++){
+        auto region = subtree[i];
+        region_depth[region] = region_parent[region] == NO_INDEX ? 0 : region_depth[region_parent[region]] + 1;
+        subtree.insert(subtree.end(), region_subregions[region].begin(), region_subregions[region].end());
+    }
+    // Add levels until the deepest jump covers the deepest region
+    unsigned int max_depth = 0;
+    for(auto region : subtree){
+        max_depth = std::max(max_depth, region_depth[region]);
+    }
+    while(region_up.empty() || (1ull << region_up.size()) <= max_depth){
+        std::vector<RegionIdx> level(region_IDs.size(), NO_INDEX);
+        for(RegionIdx i = 0; i < region_IDs.size(); i++){
+            if(region_up.empty()){
+                level[i] = region_parent[i];
+            } else if(region_up.back()[i] != NO_INDEX){
+                level[i] = region_up.back()[region_up.back()[i]];
+            }
+        }
+        region_up.push_back(std::move(level));
+    }
+    for(auto region : subtree){
+        region_up[0][region] = region_parent[region];
+        for(std::size_t k = 1; k < region_up.size(); k++){
+            auto half = region_up[k-1][region];
+            region_up[k][region] = half == NO_INDEX ? NO_INDEX : region_up[k-1][half];
+        }
+    }
+}
+
+/**
+ * @brief Datastructures::region_ancestor, find ancestor of a region
+ * @param region, region to start from
+ * @param levels, how many levels up to go
+ * @return the ancestor, NO_INDEX if the tree is not that deep
+ */
+Datastructures::RegionIdx Datastructures::region_ancestor(RegionIdx region, unsigned int levels) const{
+    for(std::size_t k = 0; levels != 0 && region != NO_INDEX; k++, levels >>= 1){
+        if(k >= region_up.size()){
+            return NO_INDEX;
+        }
+        if(levels & 1){
+            region = region_up[k][region];
+        }
+    }
+    return region;
+}
+
+/**
+ * @brief Datastructures::lowest_common_region, lowest common ancestor of two regions (a region is its own ancestor)
+ * @param region1, first region
+ * @param region2, second region
+ * @return lowest common ancestor, NO_INDEX if the regions are in different trees
+ */
+Datastructures::RegionIdx Datastructures::lowest_common_region(RegionIdx region1, RegionIdx region2) const{
+    if(region_depth[region1] < region_depth[region2]){
+        std::swap(region1, region2);
+    }
+    region1 = region_ancestor(region1, region_depth[region1] - region_depth[region2]);
+    if(region1 == region2){
+        return region1;
+    }
+    for(std::size_t k = region_up.size(); k-- > 0;){
+        if(region_up[k][region1] != region_up[k][region2]){
+            region1 = region_up[k][region1];
+            region2 = region_up[k][region2];
+        }
+    }
+    return region_up.empty() ? NO_INDEX : region_up[0][region1];
+}
+
+/**
+ * @brief Datastructures::update_euler_tour, rebuild the Euler tour if the region tree has changed
+ */
+void Datastructures::update_euler_tour() const{
+    if(!euler_dirty){
+        return;
+    }
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!euler_dirty){
+        return;
+    }
+    region_tin.assign(region_IDs.size(), 0);
+    region_tout.assign(region_IDs.size(), 0);
+    euler_order.clear();
+    euler_order.reserve(region_IDs.size());
+    // Iterative DFS, the stack holds the region and how many of its subregions are done
+    std::vector<std::pair<RegionIdx, std::size_t>> stack;
+    for(RegionIdx root = 0; root < region_IDs.size(); root++){
+        if(region_parent[root] != NO_INDEX){
+            continue;
+        }
+        stack.push_back({root, 0});
+        region_tin[root] = euler_order.size();
+        euler_order.push_back(root);
+        while(!stack.empty()){
+            auto &[region, done] = stack.back();
+            if(done < region_subregions[region].size()){
+                auto child = region_subregions[region][done++];
+                region_tin[child] = euler_order.size();
+                euler_order.push_back(child);
+                stack.push_back({child, 0});
+            } else {
+                region_tout[region] = euler_order.size();
+                stack.pop_back();
+            }
+        }
+    }
+    euler_dirty = false;
+}
+
+/**
+ * @brief Datastructures::add_train add train into the datastructure
+ * @param trainid individual train ID
+ * @param stationtimes vector pair of station ID and time the train travels
+ * @return return true if adding was successful
+ */
+bool Datastructures::add_train(TrainID trainid, std::vector<std::pair<StationID, Time>> stationtimes){
+    WriteLock lock(*this);
+    auto found_train = train_index.find(trainid);
+    if((found_train != train_index.end() && train_added[found_train->second]) || stationtimes.empty()){
+        return false;
+    } else {
+        std::vector<std::pair<StationIdx, Time>> stops;
+        stops.reserve(stationtimes.size());
+        // käy läpi kaikki asemat
+        for(auto &i : stationtimes){
+            StationIdx station = find_station(i.first);
+            // jos jokin asema ei löydy return false, muuten lisää asema junan reitille
+            if(station == NO_INDEX){
+                return false;
+            } else {
+                stops.push_back({station, i.second});
+            }
+        }
+        // lisätään uusi juna
+        TrainIdx train = intern_train(trainid);
+        for(unsigned int i = 0; i < stops.size() - 1; i++){
+            station_departures[stops[i].first].insert(
+                        departure_position(stops[i].first, stops[i].second, train), {stops[i].second, train});
+            station_next[stops[i].first].push_back({train, stops[i+1].first});
+            station_previous[stops[i+1].first].push_back({train, stops[i].first});
+        }
+        station_departures[stops.back().first].insert(
+                    departure_position(stops.back().first, stops.back().second, train), {stops.back().second, train});
+        train_stops[train] = std::move(stops);
+        train_added[train] = true;
+        index_stops(train);
+        append_connections(train);
+        links_changed();
+        return true;
+    }
+}
+/**
+ * @brief Datastructures::next_stations_from return all following stations
+ * @param id key to find wanted station where to search from
+ * @return return vector of stations
+ */
+std::vector<StationID> Datastructures::next_stations_from(StationID id) const{
+    ReadLock lock(*this);
+    StationIdx station = find_station(id);
+    if(station == NO_INDEX){
+        return {NO_STATION};
+    } else {
+        std::vector<StationID> temp;
+        for(auto &i : station_next[station]){
+            temp.push_back(station_IDs[i.second]);
+        }
+        return temp;
+    }
+}
+
+/**
+ * @brief Datastructures::train_stations_from list of stations train will pass on its' way
+ * @param stationid the starting station
+ * @param trainid the train which path we want to follow
+ * @return
+ */
+std::vector<StationID> Datastructures::train_stations_from(StationID stationid, TrainID trainid) const{
+    ReadLock lock(*this);
+    StationIdx station = find_station(stationid);
+    auto found_train = train_index.find(trainid);
+    if(station == NO_INDEX || found_train == train_index.end() || !train_added[found_train->second]){
+        return {NO_STATION};
+    } else {
+        TrainIdx train = found_train->second;
+        auto &stops = train_stops[train];
+        auto found_stop = stop_index.find(stop_key(station, train));
+        if(found_stop == stop_index.end() || found_stop->second + 1 == stops.size()){
+            return {NO_STATION};
+        }
+        std::vector<StationID> temp;
+        temp.reserve(stops.size() - found_stop->second - 1);
+        for(auto i = found_stop->second + 1; i < stops.size(); i++){
+            temp.push_back(station_IDs[stops[i].first]);
+        }
+        return temp;
+    }
+}
+
+/**
+ * @brief Datastructures::clear_trains clear datastructures
+ */
+void Datastructures::clear_trains(){
+    WriteLock lock(*this);
+    train_index.clear();
+    train_IDs.clear();
+    train_stops.clear();
+    train_added.clear();
+    stop_index.clear();
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        station_departures[i].clear();
+        station_next[i].clear();
+        station_previous[i].clear();
+    }
+    links_changed();
+    connections.clear();
+    connections_sorted = 0;
+    connections_dirty = false;
+    connections_stale = false;
+    connections_retired = 0;
+    connection_tail.clear();
+}
+
+/**
+ * @brief Datastructures::grid_cell, map coordinates into the grid cell containing them
+ * @param xy, coordinates to map
+ * @return cell index as Coord
+ */
+Coord Datastructures::grid_cell(Coord xy) const{
+    // Floor division so that negative coordinates don't share the cell around zero
+    auto floor_div = [](int value){
+        return value >= 0 ? value / GRID_CELL_SIZE : -((-(value + 1)) / GRID_CELL_SIZE) - 1;
+    };
+    return {floor_div(xy.x), floor_div(xy.y)};
+}
+
+/**
+ * @brief Datastructures::grid_insert, add station into the spatial index
+ * @param station, station to add
+ */
+void Datastructures::grid_insert(StationIdx station){
+    grid[grid_cell(station_coords[station])].push_back(station);
+    nearest_pending.push_back(station);
+    nearest_changed();
+}
+
+/**
+ * @brief Datastructures::grid_erase, remove station from the spatial index
+ * @param station, station to remove
+ */
+void Datastructures::grid_erase(StationIdx station){
+    auto found_cell = grid.find(grid_cell(station_coords[station]));
+    if(found_cell == grid.end()){
+        return;
+    }
+    auto &cell = found_cell->second;
+    auto found_station = std::find(cell.begin(), cell.end(), station);
+    if(found_station != cell.end()){
+        *found_station = cell.back();
+        cell.pop_back();
+    }
+    if(cell.empty()){
+        grid.erase(found_cell);
+    }
+    nearest_stale++;
+    nearest_changed();
+}
+
+/**
+ * @brief Datastructures::nearest_changed, schedule a rebuild of the nearest station tree
+ * once the entries checked one by one outweigh the tree
+ */
+void Datastructures::nearest_changed(){
+    if(nearest_pending.size() + nearest_stale > NEAREST_SLACK + nearest_tree.size() / 16){
+        nearest_dirty = true;
+    }
+}
+
+/**
+ * @brief Datastructures::update_nearest, rebuild the nearest station tree from the live stations if needed
+ */
+void Datastructures::update_nearest() const{
+    if(!nearest_dirty){
+        return;
+    }
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!nearest_dirty){
+        return;
+    }
+    nearest_tree.clear();
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        if(!station_removed[i]){
+            nearest_tree.push_back(i);
+        }
+    }
+    // Median split of every range, same layout as the search walks
+    std::vector<std::tuple<std::size_t, std::size_t, unsigned int>> stack;
+    stack.push_back({0, nearest_tree.size(), 0});
+    while(!stack.empty()){
+        auto [lo, hi, depth] = stack.back();
+        stack.pop_back();
+        if(hi - lo <= 1){
+            continue;
+        }
+        std::size_t middle = (lo + hi) / 2;
+        auto lambda = [this, depth = depth](StationIdx first, StationIdx second){
+            Coord a = station_coords[first];
+            Coord b = station_coords[second];
+            return depth % 2 == 0 ? a.x < b.x : a.y < b.y;
+        };
+        std::nth_element(nearest_tree.begin() + lo, nearest_tree.begin() + middle,
+                         nearest_tree.begin() + hi, lambda);
+        stack.push_back({lo, middle, depth + 1});
+        stack.push_back({middle + 1, hi, depth + 1});
+    }
+    nearest_coords.clear();
+    nearest_coords.reserve(nearest_tree.size());
+    for(auto station : nearest_tree){
+        nearest_coords.push_back(station_coords[station]);
+    }
+    nearest_pending.clear();
+    nearest_stale = 0;
+    nearest_dirty = false;
+}
+
+/**
+ * @brief distance calculate distance between two points
+ * @param a the first point
+ * @param b the second point
+ * @return return the calculated distance
+ */
+int distance(Coord a, Coord b){
+    return trunc(sqrt(pow(a.x-b.x,2)+pow(a.y-b.y,2)));
+}
+
+/**
+ * @brief straight_line, distance between two points before truncating
+ * @param a the first point
+ * @param b the second point
+ * @return the exact distance
+ */
+double straight_line(Coord a, Coord b){
+    return std::hypot(static_cast<double>(a.x) - b.x, static_cast<double>(a.y) - b.y);
+}
+
+/**
+ * @brief Datastructures::SearchScratch::start, begin a new search over given number of stations
+ * @param stations, number of station slots
+ * @param trains, number of train slots, only needed by the connection scan
+ */
+void Datastructures::SearchScratch::start(std::size_t stations, std::size_t trains){
+    if(stamp.size() < stations){
+        stamp.resize(stations, 0);
+        dist.resize(stations);
+        parent.resize(stations);
+        key.resize(stations);
+        heap_pos.resize(stations);
+        via.resize(stations);
+    }
+    if(boarded.size() < trains){
+        boarded.resize(trains, 0);
+        riding_stop.resize(trains);
+        train_slot.resize(trains, NO_INDEX);
+    }
+    generation++;
+    // Stamps of old searches could collide with the new generation after wrapping around
+    if(generation == 0){
+        std::fill(stamp.begin(), stamp.end(), 0);
+        std::fill(boarded.begin(), boarded.end(), 0);
+        generation = 1;
+    }
+    heap.clear();
+    queue.clear();
+    settled = 0;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::reached, has the station been reached in the current search
+ * @param station, station to check
+ * @return true if dist and parent of the station are valid
+ */
+bool Datastructures::SearchScratch::reached(StationIdx station) const{
+    return stamp[station] == generation;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::riding, is a train boarded and still on board at a stop
+ * @param train, train of the hop
+ * @param stop, position in train_stops where the hop starts
+ * @return true if the previous hop ridden on the train ended at the stop
+ */
+bool Datastructures::SearchScratch::riding(TrainIdx train, unsigned int stop) const{
+    return boarded[train] == generation && riding_stop[train] == stop;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::ride, record that a hop of a train was ridden
+ * @param train, train of the hop
+ * @param stop, position in train_stops where the hop starts
+ */
+void Datastructures::SearchScratch::ride(TrainIdx train, unsigned int stop){
+    boarded[train] = generation;
+    riding_stop[train] = stop + 1;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::reach, record that a station was reached
+ * @param station, reached station
+ * @param distance, distance from the start
+ * @param from, previous station on the route, NO_INDEX for the start
+ * @param estimate, lower bound for the distance still left, 0 when the search isn't goal directed
+ */
+void Datastructures::SearchScratch::reach(StationIdx station, Distance distance, StationIdx from, Distance estimate){
+    stamp[station] = generation;
+    dist[station] = distance;
+    parent[station] = from;
+    key[station] = distance + estimate;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::heap_push, add a reached station into the heap
+ * @param station, station reached with reach()
+ */
+void Datastructures::SearchScratch::heap_push(StationIdx station){
+    heap.push_back(station);
+    sift_up(heap.size() - 1);
+}
+
+/**
+ * @brief Datastructures::SearchScratch::heap_decrease, restore heap order after dist of a station decreased
+ * @param station, station in the heap updated with reach()
+ */
+void Datastructures::SearchScratch::heap_decrease(StationIdx station){
+    sift_up(heap_pos[station]);
+}
+
+/**
+ * @brief Datastructures::SearchScratch::heap_pop, take the station with the smallest key from the heap
+ * @return the station, it is marked settled
+ */
+Datastructures::StationIdx Datastructures::SearchScratch::heap_pop(){
+    StationIdx top = heap.front();
+    heap_pos[top] = SETTLED;
+    settled++;
+    heap.front() = heap.back();
+    heap.pop_back();
+    if(!heap.empty()){
+        heap_pos[heap.front()] = 0;
+        sift_down(0);
+    }
+    return top;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::sift_up, move a heap entry up until its parent is not further away
+ * @param position, position of the entry in heap
+ */
+void Datastructures::SearchScratch::sift_up(unsigned int position){
+    StationIdx station = heap[position];
+    while(position > 0){
+        unsigned int up = (position - 1) / 4;
+        if(key[heap[up]] <= key[station]){
+            break;
+        }
+        heap[position] = heap[up];
+        heap_pos[heap[position]] = position;
+        position = up;
+    }
+    heap[position] = station;
+    heap_pos[station] = position;
+}
+
+/**
+ * @brief Datastructures::SearchScratch::sift_down, move a heap entry down until its children are not closer
+ * @param position, position of the entry in heap
+ */
+void Datastructures::SearchScratch::sift_down(unsigned int position){
+    StationIdx station = heap[position];
+    while(true){
+        unsigned int first = 4 * position + 1;
+        if(first >= heap.size()){
+            break;
+        }
+        unsigned int last = std::min<std::size_t>(first + 4, heap.size());
+        unsigned int smallest = first;
+        for(unsigned int i = first + 1; i < last; i++){
+            if(key[heap[i]] < key[heap[smallest]]){
+                smallest = i;
+            }
+        }
+        if(key[station] <= key[heap[smallest]]){
+            break;
+        }
+        heap[position] = heap[smallest];
+        heap_pos[heap[position]] = position;
+        position = smallest;
+    }
+    heap[position] = station;
+    heap_pos[station] = position;
+}
+
+/**
+ * @brief Datastructures::route_from_parents, walk the parents of the last search back from a station
+ * @param to, station where the route ends, must have been reached
+ * @return stations of the route from the start with cumulative distances
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_from_parents(StationIdx to) const{
+    std::size_t length = 0;
+    for(auto station = to; station != NO_INDEX; station = scratch.parent[station]){
+        length++;
+    }
+    std::vector<std::pair<StationID, Distance>> route(length);
+    // Filled from the end, distances of the edges are summed up afterwards
+    auto station = to;
+    for(std::size_t i = length; i-- > 0;){
+        auto previous = scratch.parent[station];
+        route[i] = {station_IDs[station],
+                    previous == NO_INDEX ? 0 : distance(station_coords[previous], station_coords[station])};
+        station = previous;
+    }
+    for(std::size_t i = 1; i < length; i++){
+        route[i].second += route[i-1].second;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::route_from_path, list the stations of a route with cumulative distances
+ * @param path, stations of the route in order
+ * @return station IDs and distances from the start
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_from_path(std::vector<StationIdx> const& path) const{
+    std::vector<std::pair<StationID, Distance>> route;
+    route.reserve(path.size());
+    Distance length = 0;
+    for(std::size_t i = 0; i < path.size(); i++){
+        if(i > 0){
+            length += distance(station_coords[path[i-1]], station_coords[path[i]]);
+        }
+        route.push_back({station_IDs[path[i]], length});
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::remove_train, take one train out of the timetable
+ * @param trainid, train to remove
+ * @return true if the train had been added with add_train
+ */
+bool Datastructures::remove_train(TrainID trainid){
+    WriteLock lock(*this);
+    auto found_train = train_index.find(trainid);
+    if(found_train == train_index.end() || !train_added[found_train->second]){
+        return false;
+    }
+    TrainIdx train = found_train->second;
+    for(auto &stop : train_stops[train]){
+        erase_departure(stop.first, stop.second, train);
+        // The search graph is patched row by row unless it is going to be rebuilt anyway
+        if(!links_dirty){
+            forward_links.erase_train(stop.first, train);
+            backward_links.erase_train(stop.first, train);
+        }
+    }
+    unlink_train(train);
+    train_stops[train].clear();
+    train_added[train] = false;
+    link_version++;
+    timetable_version++;
+    // Components and landmark distances only get more pessimistic than the network now is,
+    // but shortcuts of the hierarchy may go over the removed links
+    hierarchy_dirty = true;
+    return true;
+}
+
+/**
+ * @brief Datastructures::update_train_times, give the stops of a train new times
+ * @param trainid, train whose times change
+ * @param times, new time of every stop in route order
+ * @return true if the train had been added with add_train and times has a time for each stop,
+ * all of them before NO_TIME
+ */
+bool Datastructures::update_train_times(TrainID trainid, std::vector<Time> times){
+    WriteLock lock(*this);
+    auto found_train = train_index.find(trainid);
+    if(found_train == train_index.end() || !train_added[found_train->second]
+            || times.size() != train_stops[found_train->second].size()){
+        return false;
+    }
+    for(auto time : times){
+        if(time >= NO_TIME){
+            return false;
+        }
+    }
+    retime_train(found_train->second, times);
+    return true;
+}
+
+/**
+ * @brief Datastructures::delay_train, make a train late from one of its stops onwards
+ * @param trainid, delayed train
+ * @param stationid, first station where the train is late
+ * @param delay, minutes added to this stop and every later one
+ * @return true if the train stops at the station and every delayed time stays before NO_TIME
+ */
+bool Datastructures::delay_train(TrainID trainid, StationID stationid, Time delay){
+    WriteLock lock(*this);
+    StationIdx station = find_station(stationid);
+    auto found_train = train_index.find(trainid);
+    if(station == NO_INDEX || found_train == train_index.end() || !train_added[found_train->second]){
+        return false;
+    }
+    TrainIdx train = found_train->second;
+    auto found_stop = stop_index.find(stop_key(station, train));
+    if(found_stop == stop_index.end()){
+        return false;
+    }
+    auto &stops = train_stops[train];
+    std::vector<Time> times;
+    times.reserve(stops.size());
+    for(unsigned int i = 0; i < stops.size(); i++){
+        unsigned int time = stops[i].second + (i >= found_stop->second ? delay : 0);
+        if(time >= NO_TIME){
+            return false;
+        }
+        times.push_back(time);
+    }
+    retime_train(train, times);
+    return true;
+}
+
+/**
+ * @brief Datastructures::retime_train, move the departures and connections of a train to new times
+ * @param train, train whose times change, its stations stay the same
+ * @param times, new time of every stop
+ */
+void Datastructures::retime_train(TrainIdx train, std::vector<Time> const& times){
+    auto &stops = train_stops[train];
+    retire_connections(train);
+    for(unsigned int i = 0; i < stops.size(); i++){
+        StationIdx station = stops[i].first;
+        erase_departure(station, stops[i].second, train);
+        stops[i].second = times[i];
+        station_departures[station].insert(departure_position(station, times[i], train), {times[i], train});
+    }
+    append_connections(train);
+    timetable_version++;
+}
+
+/**
+ * @brief Datastructures::route_any return some path between two stations
+ * @param fromid station where to start the search
+ * @param toid station where to stop the search
+ * @return return all stations in order and the overall distance
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_any(StationID fromid, StationID toid) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{NO_STATION,NO_DISTANCE}};
+    }
+    RouteKey key{from, to, RouteQuery::ANY, 0};
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        if(CachedRoute* cached = find_cached_route(key)){
+            return cached->route;
+        }
+    }
+    auto route = any_route(from, to);
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        store_cached_route(key).route = route;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::any_route, BFS for route_any
+ * @param from, station where to start the search
+ * @param to, station where to stop the search
+ * @return all stations in order and the overall distance
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::any_route(StationIdx from, StationIdx to) const{
+    if(from == to){
+        return {};
+    }
+    update_links();
+    update_components();
+    if(!may_reach(from, to)){
+        return {};
+    }
+    // BFS, parents of the visited stations are stored so the route can be walked back
+    auto &links = forward_links;
+    scratch.start(station_IDs.size());
+    scratch.reach(from, 0, NO_INDEX);
+    scratch.queue.push_back(from);
+    for(std::size_t head = 0; head < scratch.queue.size() && !scratch.reached(to); head++){
+        StationIdx current_node = scratch.queue[head];
+        for(auto link = links.first[current_node]; link < links.end[current_node]; link++){
+            StationIdx station = links.to[link];
+            if(!scratch.reached(station)){
+                scratch.reach(station, scratch.dist[current_node] + 1, current_node);
+                scratch.queue.push_back(station);
+            }
+        }
+    }
+    if(!scratch.reached(to)){
+       return {};
+    }
+    return route_from_parents(to);
+}
+
+/**
+ * @brief Datastructures::route_least_stations, route through the fewest stations between two stations
+ * @param fromid station where to start the search
+ * @param toid station where to stop the search
+ * @return all stations of the route in order with cumulative distances, empty if there is no route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_least_stations(StationID fromid, StationID toid) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{NO_STATION, NO_DISTANCE}};
+    }
+    RouteKey key{from, to, RouteQuery::LEAST_STATIONS, 0};
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        if(CachedRoute* cached = find_cached_route(key)){
+            return cached->route;
+        }
+    }
+    auto route = least_stations_route(from, to);
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        store_cached_route(key).route = route;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::least_stations_route, bidirectional BFS for route_least_stations
+ * @param from, station where to start the search
+ * @param to, station where to stop the search
+ * @return all stations of the route in order with cumulative distances, empty if there is no route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::least_stations_route(StationIdx from, StationIdx to) const{
+    if(from == to){
+        return {};
+    }
+    update_links();
+    update_components();
+    if(!may_reach(from, to)){
+        return {};
+    }
+    // BFS from both ends, dist counts links from the search's own end
+    auto &forward = scratch;
+    auto &backward = reverse_scratch;
+    forward.start(station_IDs.size());
+    backward.start(station_IDs.size());
+    forward.reach(from, 0, NO_INDEX);
+    forward.queue.push_back(from);
+    backward.reach(to, 0, NO_INDEX);
+    backward.queue.push_back(to);
+    std::size_t forward_head = 0;
+    std::size_t backward_head = 0;
+    StationIdx meeting = NO_INDEX;
+    Distance best = std::numeric_limits<Distance>::max();
+    while(meeting == NO_INDEX && forward_head < forward.queue.size() && backward_head < backward.queue.size()){
+        bool go_forward = forward.queue.size() - forward_head <= backward.queue.size() - backward_head;
+        auto &search = go_forward ? forward : backward;
+        auto &other = go_forward ? backward : forward;
+        auto &head = go_forward ? forward_head : backward_head;
+        auto &links = go_forward ? forward_links : backward_links;
+        // A whole level at a time, so the shortest of the meetings found on it can be picked
+        for(std::size_t level_end = search.queue.size(); head < level_end; head++){
+            StationIdx current = search.queue[head];
+            for(auto link = links.first[current]; link < links.end[current]; link++){
+                StationIdx station = links.to[link];
+                if(search.reached(station)){
+                    continue;
+                }
+                search.reach(station, search.dist[current] + 1, current);
+                search.queue.push_back(station);
+                if(other.reached(station) && search.dist[station] + other.dist[station] < best){
+                    best = search.dist[station] + other.dist[station];
+                    meeting = station;
+                }
+            }
+        }
+    }
+    if(meeting == NO_INDEX){
+        return {};
+    }
+
+    std::vector<StationIdx> path;
+    for(auto station = meeting; station != NO_INDEX; station = forward.parent[station]){
+        path.push_back(station);
+    }
+    std::reverse(path.begin(), path.end());
+    for(auto station = backward.parent[meeting]; station != NO_INDEX; station = backward.parent[station]){
+        path.push_back(station);
+    }
+    return route_from_path(path);
+}
+
+/**
+ * @brief Datastructures::route_with_cycle, route that ends at a station already on it
+ * @param fromid station where to start the route
+ * @return stations of the route in order, the last one repeats an earlier station, empty if there is no cycle
+ */
+std::vector<StationID> Datastructures::route_with_cycle(StationID fromid) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    if(from == NO_INDEX){
+        return {NO_STATION};
+    }
+    update_links();
+    update_components();
+    if(!component_cycle[station_component[from]]){
+        return {};
+    }
+    // Iterative DFS, dist is the colour of a reached station: GREY while it is on the path
+    // and BLACK once every station after it has been searched without finding a cycle
+    constexpr Distance GREY = 1;
+    constexpr Distance BLACK = 2;
+    auto &links = forward_links;
+    scratch.start(station_IDs.size());
+    scratch.stack.clear();
+    scratch.reach(from, GREY, NO_INDEX);
+    scratch.stack.push_back({from, links.first[from]});
+    while(!scratch.stack.empty()){
+        auto &[current, next] = scratch.stack.back();
+        if(next == links.end[current]){
+            scratch.dist[current] = BLACK;
+            scratch.stack.pop_back();
+            continue;
+        }
+        StationIdx station = links.to[next++];
+        if(!scratch.reached(station)){
+            if(component_cycle[station_component[station]]){
+                scratch.reach(station, GREY, current);
+                scratch.stack.push_back({station, links.first[station]});
+            }
+        } else if(scratch.dist[station] == GREY){
+            std::vector<StationID> route;
+            route.reserve(scratch.stack.size() + 1);
+            for(auto &[on_path, position] : scratch.stack){
+                route.push_back(station_IDs[on_path]);
+            }
+            route.push_back(station_IDs[station]);
+            return route;
+        }
+    }
+    return {};
+}
+
+/**
+ * @brief Datastructures::route_shortest_distance, shortest route between two stations by track length
+ * @param fromid station where to start the search
+ * @param toid station where to stop the search
+ * @return all stations of the route in order with cumulative distances, empty if there is no route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_shortest_distance(StationID fromid, StationID toid) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{NO_STATION, NO_DISTANCE}};
+    }
+    RouteKey key{from, to, RouteQuery::SHORTEST_DISTANCE, 0};
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        if(CachedRoute* cached = find_cached_route(key)){
+            last_settled = 0;
+            return cached->route;
+        }
+    }
+    auto route = shortest_distance_route(from, to);
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        store_cached_route(key).route = route;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::shortest_distance_route, search for route_shortest_distance
+ * @param from, station where to start the search
+ * @param to, station where to stop the search
+ * @return all stations of the route in order with cumulative distances, empty if there is no route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::shortest_distance_route(StationIdx from, StationIdx to) const{
+    if(from == to){
+        return {};
+    }
+    update_links();
+    update_components();
+    if(!may_reach(from, to)){
+        last_settled = 0;
+        return {};
+    }
+    if(hierarchy_enabled){
+        update_hierarchy();
+        return route_in_hierarchy(from, to);
+    }
+    update_goal_bounds();
+    // A* with a consistent estimate (Dijkstra when the estimate is 0), so a settled station
+    // is final and the heap only holds stations reached but not yet settled
+    auto &links = forward_links;
+    scratch.start(station_IDs.size());
+    scratch.reach(from, 0, NO_INDEX, distance_estimate(from, to));
+    scratch.heap_push(from);
+    while(!scratch.heap.empty()){
+        StationIdx current = scratch.heap_pop();
+        if(current == to){
+            last_settled = scratch.settled;
+            return route_from_parents(to);
+        }
+        for(auto link = links.first[current]; link < links.end[current]; link++){
+            StationIdx station = links.to[link];
+            Distance length = scratch.dist[current] + links.length[link];
+            if(!scratch.reached(station)){
+                scratch.reach(station, length, current, distance_estimate(station, to));
+                scratch.heap_push(station);
+            } else if(scratch.heap_pos[station] != SearchScratch::SETTLED && length < scratch.dist[station]){
+                scratch.reach(station, length, current, scratch.key[station] - scratch.dist[station]);
+                scratch.heap_decrease(station);
+            }
+        }
+    }
+    last_settled = scratch.settled;
+    return {};
+}
+
+/**
+ * @brief Datastructures::set_route_cache_capacity, choose how many route results are kept
+ * @param capacity, most entries, 0 turns the cache off and empties it
+ */
+void Datastructures::set_route_cache_capacity(std::size_t capacity){
+    WriteLock lock(*this);
+    std::lock_guard<std::mutex> guard(route_cache_mutex);
+    route_cache_counts.capacity = capacity;
+    trim_route_cache();
+}
+
+/**
+ * @brief Datastructures::route_cache_stats, how well the route cache is doing
+ * @return hit, miss and drop counts since the last clear_all and the current size
+ */
+RouteCacheStats Datastructures::route_cache_stats() const{
+    ReadLock lock(*this);
+    std::lock_guard<std::mutex> guard(route_cache_mutex);
+    RouteCacheStats stats = route_cache_counts;
+    stats.entries = route_cache.size();
+    return stats;
+}
+
+/**
+ * @brief Datastructures::RouteKey::operator==, compare cache keys
+ * @param other, key to compare with
+ * @return true if both keys are for the same query
+ */
+bool Datastructures::RouteKey::operator==(RouteKey const& other) const{
+    return from == other.from && to == other.to && query == other.query && start == other.start;
+}
+
+/**
+ * @brief Datastructures::RouteKeyHash::operator(), hash of a cache key
+ * @param key, key to hash
+ * @return hash value
+ */
+std::size_t Datastructures::RouteKeyHash::operator()(RouteKey const& key) const{
+    std::uint64_t stations = (static_cast<std::uint64_t>(key.from) << 32) | key.to;
+    std::uint64_t query = (static_cast<std::uint64_t>(key.query) << 16) | key.start;
+    return std::hash<std::uint64_t>()(stations ^ (query * 0x9e3779b97f4a7c15ull));
+}
+
+/**
+ * @brief Datastructures::route_version, network version a cached result of the query depends on
+ * @param key, the query
+ * @return timetable_version for timed queries, link_version for the others
+ */
+unsigned long Datastructures::route_version(RouteKey const& key) const{
+    return key.query == RouteQuery::EARLIEST_ARRIVAL ? timetable_version : link_version;
+}
+
+/**
+ * @brief Datastructures::find_cached_route, look a query up in the route cache and count the hit or miss
+ * @param key, the query, route_cache_mutex must be held
+ * @return the valid entry moved to the front, nullptr if there is none
+ */
+Datastructures::CachedRoute* Datastructures::find_cached_route(RouteKey const& key) const{
+    auto found = route_cache_index.find(key);
+    if(found == route_cache_index.end()){
+        route_cache_counts.misses++;
+        return nullptr;
+    }
+    if(found->second->version != route_version(key)){
+        route_cache.erase(found->second);
+        route_cache_index.erase(found);
+        route_cache_counts.stale++;
+        route_cache_counts.misses++;
+        return nullptr;
+    }
+    route_cache_counts.hits++;
+    route_cache.splice(route_cache.begin(), route_cache, found->second);
+    return &route_cache.front();
+}
+
+/**
+ * @brief Datastructures::store_cached_route, make the front entry of the route cache for a query
+ * @param key, the query, route_cache_mutex must be held
+ * @return the entry, its results are for the caller to fill in
+ */
+Datastructures::CachedRoute& Datastructures::store_cached_route(RouteKey const& key) const{
+    auto found = route_cache_index.find(key);
+    if(found != route_cache_index.end()){
+        // Another thread answered the same query at the same time
+        route_cache.splice(route_cache.begin(), route_cache, found->second);
+    } else {
+        route_cache.push_front({key, 0, {}, {}});
+        route_cache_index[key] = route_cache.begin();
+        trim_route_cache();
+    }
+    route_cache.front().version = route_version(key);
+    return route_cache.front();
+}
+
+/**
+ * @brief Datastructures::trim_route_cache, drop least recently used entries over the capacity
+ */
+void Datastructures::trim_route_cache() const{
+    while(route_cache.size() > route_cache_counts.capacity){
+        route_cache_index.erase(route_cache.back().key);
+        route_cache.pop_back();
+        route_cache_counts.evictions++;
+    }
+}
+
+/**
+ * @brief Datastructures::links_changed, note that train links or station coordinates changed
+ */
+void Datastructures::links_changed(){
+    link_version++;
+    timetable_version++;
+    links_dirty = true;
+    hierarchy_dirty = true;
+    goal_dirty = true;
+    components_dirty = true;
+}
+
+/**
+ * @brief Datastructures::station_added, give a new station without links an empty row in the
+ *        views built from the links, so that adding a station doesn't rebuild them
+ * @param station, the new station, the last one
+ */
+void Datastructures::station_added(StationIdx station){
+    // A view that isn't built yet is built with the station in it
+    if(!links_dirty && forward_links.first.size() == station + 1){
+        forward_links.add_row();
+        backward_links.add_row();
+    } else {
+        links_dirty = true;
+    }
+    if(!hierarchy_dirty && hierarchy_up_first.size() == station + 1){
+        // Contracted last, no links go up or down from it
+        hierarchy_rank.push_back(station);
+        hierarchy_up_first.push_back(hierarchy_up_first.back());
+        hierarchy_down_first.push_back(hierarchy_down_first.back());
+    } else {
+        hierarchy_dirty = true;
+    }
+    if(!goal_dirty && landmark_from.size() == station * landmark_count){
+        landmark_from.resize(landmark_from.size() + landmark_count, NO_DISTANCE);
+        landmark_to.resize(landmark_to.size() + landmark_count, NO_DISTANCE);
+    } else {
+        goal_dirty = true;
+    }
+    if(components_dirty || station_component.size() != station){
+        components_dirty = true;
+        return;
+    }
+    // A component of its own, numbered last as nothing links to it
+    std::size_t component = component_lowest.size();
+    std::size_t components = component + 1;
+    station_component.push_back(component);
+    component_lowest.push_back(component);
+    component_cycle.push_back(false);
+    if(components * components > REACH_BITS_LIMIT){
+        component_reach.clear();
+    } else if(!component_reach.empty() || component == 0){
+        std::size_t words = (components + 63) / 64;
+        if(words != component_words){
+            // The rows get one word longer, the bits already set keep their positions
+            std::vector<std::uint64_t> reach(components * words, 0);
+            for(std::size_t c = 0; c < component; c++){
+                std::copy(component_reach.begin() + c * component_words, component_reach.begin() + (c + 1) * component_words,
+                          reach.begin() + c * words);
+            }
+            component_reach.swap(reach);
+            component_words = words;
+        } else {
+            component_reach.resize(components * words, 0);
+        }
+        component_reach[component * words + component / 64] |= std::uint64_t(1) << (component % 64);
+    }
+}
+
+/**
+ * @brief Datastructures::update_links, freeze the train links for searching if they changed
+ */
+void Datastructures::update_links() const{
+    if(!links_dirty){
+        return;
+    }
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!links_dirty){
+        return;
+    }
+    forward_links.build(station_next, station_coords);
+    backward_links.build(station_previous, station_coords);
+    links_dirty = false;
+}
+
+/**
+ * @brief Datastructures::LinkGraph::build, copy links into the flat arrays
+ * @param links, links of every station as train and the station at the other end
+ * @param coords, station coordinates the link lengths are computed from
+ */
+void Datastructures::LinkGraph::build(std::vector<std::vector<std::pair<TrainIdx, StationIdx>>> const& links,
+                                      std::vector<Coord> const& coords){
+    std::size_t total = 0;
+    for(auto &station_links : links){
+        total += station_links.size();
+    }
+    first.clear();
+    first.reserve(links.size() + 1);
+    first.push_back(0);
+    end.clear();
+    end.reserve(links.size());
+    to.clear();
+    to.reserve(total);
+    length.clear();
+    length.reserve(total);
+    train.clear();
+    train.reserve(total);
+    for(StationIdx i = 0; i < links.size(); i++){
+        for(auto &[link_train, station] : links[i]){
+            to.push_back(station);
+            length.push_back(distance(coords[i], coords[station]));
+            train.push_back(link_train);
+        }
+        first.push_back(to.size());
+        end.push_back(to.size());
+    }
+}
+
+/**
+ * @brief Datastructures::LinkGraph::replace_train, replace the links of a train in one row
+ * @param station, station whose row is patched
+ * @param link_train, train whose links are replaced
+ * @param links, links of the station, those of link_train are copied into the row
+ * @param coords, station coordinates the link lengths are computed from
+ */
+void Datastructures::LinkGraph::replace_train(StationIdx station, TrainIdx link_train,
+                                              std::vector<std::pair<TrainIdx, StationIdx>> const& links,
+                                              std::vector<Coord> const& coords){
+    erase_train(station, link_train);
+    for(auto &[other_train, other] : links){
+        if(other_train == link_train){
+            to[end[station]] = other;
+            length[end[station]] = distance(coords[station], coords[other]);
+            train[end[station]] = link_train;
+            end[station]++;
+        }
+    }
+}
+
+/**
+ * @brief Datastructures::LinkGraph::add_row, add an empty row for a new station after the others
+ */
+void Datastructures::LinkGraph::add_row(){
+    first.push_back(to.size());
+    end.push_back(to.size());
+}
+
+/**
+ * @brief Datastructures::LinkGraph::erase_train, take the links of a train out of one row
+ * @param station, station whose row is patched
+ * @param link_train, train whose links are removed
+ */
+void Datastructures::LinkGraph::erase_train(StationIdx station, TrainIdx link_train){
+    // Links that stay keep their order, like station_next after remove_if
+    unsigned int kept = first[station];
+    for(auto link = first[station]; link < end[station]; link++){
+        if(train[link] != link_train){
+            to[kept] = to[link];
+            length[kept] = length[link];
+            train[kept] = train[link];
+            kept++;
+        }
+    }
+    end[station] = kept;
+}
+
+/**
+ * @brief Datastructures::update_components, recompute the strongly connected components if links changed
+ */
+void Datastructures::update_components() const{
+    if(!components_dirty){
+        return;
+    }
+    update_links();
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!components_dirty){
+        return;
+    }
+    // Tarjan's algorithm with an explicit stack of calls so long train lines don't overflow
+    // the call stack. A component is finished only after every component it links to.
+    std::size_t stations = station_IDs.size();
+    auto &links = forward_links;
+    std::vector<unsigned int> order(stations, NO_INDEX);
+    std::vector<unsigned int> low(stations);
+    std::vector<bool> on_path(stations, false);
+    std::vector<StationIdx> path;
+    std::vector<std::pair<StationIdx, unsigned int>> calls;
+    station_component.assign(stations, NO_INDEX);
+    component_lowest.clear();
+    component_cycle.clear();
+    unsigned int counter = 0;
+    for(StationIdx root = 0; root < stations; root++){
+        if(order[root] != NO_INDEX){
+            continue;
+        }
+        order[root] = low[root] = counter++;
+        path.push_back(root);
+        on_path[root] = true;
+        calls.push_back({root, links.first[root]});
+        while(!calls.empty()){
+            auto &[current, next] = calls.back();
+            if(next < links.end[current]){
+                StationIdx station = links.to[next++];
+                if(order[station] == NO_INDEX){
+                    order[station] = low[station] = counter++;
+                    path.push_back(station);
+                    on_path[station] = true;
+                    calls.push_back({station, links.first[station]});
+                } else if(on_path[station]){
+                    low[current] = std::min(low[current], order[station]);
+                }
+                continue;
+            }
+            StationIdx finished = current;
+            calls.pop_back();
+            if(!calls.empty()){
+                low[calls.back().first] = std::min(low[calls.back().first], low[finished]);
+            }
+            if(low[finished] != order[finished]){
+                continue;
+            }
+            // The stations after finished on the path form its component
+            unsigned int component = component_lowest.size();
+            auto first = std::find(path.rbegin(), path.rend(), finished).base() - 1;
+            for(auto member = first; member != path.end(); member++){
+                station_component[*member] = component;
+                on_path[*member] = false;
+            }
+            unsigned int lowest = component;
+            bool cycle = false;
+            for(auto member = first; member != path.end(); member++){
+                for(auto link = links.first[*member]; link < links.end[*member]; link++){
+                    unsigned int other = station_component[links.to[link]];
+                    if(other == component){
+                        // A link inside the component, a self loop if it has just one station
+                        cycle = true;
+                    } else {
+                        lowest = std::min(lowest, component_lowest[other]);
+                        cycle = cycle || component_cycle[other];
+                    }
+                }
+            }
+            component_lowest.push_back(lowest);
+            component_cycle.push_back(cycle);
+            path.erase(first, path.end());
+        }
+    }
+
+    // Exact reachability between components as one bit row per component, when it fits.
+    // Links only go to smaller components, so the rows they lead to are ready first.
+    std::size_t components = component_lowest.size();
+    component_reach.clear();
+    component_words = (components + 63) / 64;
+    if(components * components <= REACH_BITS_LIMIT){
+        component_reach.assign(components * component_words, 0);
+        std::vector<unsigned int> first(components + 1, 0);
+        for(StationIdx i = 0; i < stations; i++){
+            first[station_component[i] + 1]++;
+        }
+        for(std::size_t c = 0; c < components; c++){
+            first[c + 1] += first[c];
+        }
+        std::vector<StationIdx> members(stations);
+        std::vector<unsigned int> filled(first.begin(), first.end() - 1);
+        for(StationIdx i = 0; i < stations; i++){
+            members[filled[station_component[i]]++] = i;
+        }
+        for(std::size_t c = 0; c < components; c++){
+            std::uint64_t* row = component_reach.data() + c * component_words;
+            row[c / 64] |= std::uint64_t(1) << (c % 64);
+            for(auto member = first[c]; member < first[c + 1]; member++){
+                for(auto link = links.first[members[member]]; link < links.end[members[member]]; link++){
+                    unsigned int other = station_component[links.to[link]];
+                    if(other != c){
+                        std::uint64_t const* other_row = component_reach.data() + other * component_words;
+                        // Only words up to other can have bits set in its row
+                        for(std::size_t word = 0; word <= other / 64; word++){
+                            row[word] |= other_row[word];
+                        }
+                    }
+                }
+            }
+        }
+    }
+    components_dirty = false;
+}
+
+/**
+ * @brief Datastructures::may_reach, quick test whether there can be a route between two stations
+ * @param from, station where the route starts
+ * @param to, station where the route ends
+ * @return false if train links certainly don't lead from from to to, exact unless there are
+ * too many components for the reachability bits
+ */
+bool Datastructures::may_reach(StationIdx from, StationIdx to) const{
+    unsigned int start = station_component[from];
+    unsigned int end = station_component[to];
+    if(start == end){
+        return true;
+    }
+    if(end > start || end < component_lowest[start]){
+        return false;
+    }
+    if(component_reach.empty()){
+        return true;
+    }
+    return (component_reach[start * component_words + end / 64] >> (end % 64)) & 1;
+}
+
+/**
+ * @brief Datastructures::stations_within_distance, every station a route of at most budget track length reaches
+ * @param fromid station where the routes start
+ * @param budget, longest route length
+ * @param result, stations by distance with the previous station of the shortest route to each
+ * @return false if the station doesn't exist
+ */
+bool Datastructures::stations_within_distance(StationID fromid, Distance budget, Reachable& result) const{
+    ReadLock lock(*this);
+    result.stations.clear();
+    result.costs.clear();
+    result.previous.clear();
+    StationIdx from = find_station(fromid);
+    if(from == NO_INDEX){
+        return false;
+    }
+    update_links();
+    auto &links = forward_links;
+    // Dijkstra, via holds the position of a settled station in result
+    scratch.start(station_IDs.size());
+    scratch.reach(from, 0, NO_INDEX);
+    scratch.heap_push(from);
+    while(!scratch.heap.empty()){
+        StationIdx current = scratch.heap_pop();
+        scratch.via[current] = result.stations.size();
+        result.stations.push_back(station_IDs[current]);
+        result.costs.push_back(scratch.dist[current]);
+        result.previous.push_back(current == from ? NO_VALUE : scratch.via[scratch.parent[current]]);
+        for(auto link = links.first[current]; link < links.end[current]; link++){
+            StationIdx station = links.to[link];
+            Distance length = scratch.dist[current] + links.length[link];
+            if(length > budget){
+                continue;
+            }
+            if(!scratch.reached(station)){
+                scratch.reach(station, length, current);
+                scratch.heap_push(station);
+            } else if(scratch.heap_pos[station] != SearchScratch::SETTLED && length < scratch.dist[station]){
+                scratch.reach(station, length, current);
+                scratch.heap_decrease(station);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Datastructures::stations_within_time, every station trains reach within budget minutes from starttime
+ * @param fromid station where the journeys start
+ * @param starttime earliest time to leave
+ * @param budget, most minutes from starttime to arrival
+ * @param result, stations by earliest arrival, costs are minutes after starttime
+ * @return false if the station doesn't exist
+ */
+bool Datastructures::stations_within_time(StationID fromid, Time starttime, Time budget, Reachable& result) const{
+    ReadLock lock(*this);
+    result.stations.clear();
+    result.costs.clear();
+    result.previous.clear();
+    StationIdx from = find_station(fromid);
+    if(from == NO_INDEX){
+        return false;
+    }
+    update_connections();
+    unsigned int const limit = starttime + budget;
+    // Connection scan as in route_earliest_arrival, queue lists the reached stations
+    scratch.start(station_IDs.size(), train_IDs.size());
+    scratch.reach(from, starttime, NO_INDEX);
+    scratch.queue.push_back(from);
+    auto first = std::lower_bound(connections.begin(), connections.end(), starttime,
+                                  [](Connection const& connection, Time value){return connection.departure < value;});
+    for(auto i = first; i != connections.end() && i->departure <= limit; i++){
+        if(!scratch.riding(i->train, i->stop)){
+            if(!scratch.reached(i->from) || scratch.dist[i->from] > i->departure){
+                continue;
+            }
+        }
+        scratch.ride(i->train, i->stop);
+        if(i->arrival > limit){
+            continue;
+        }
+        if(!scratch.reached(i->to)){
+            scratch.reach(i->to, i->arrival, i->from);
+            scratch.queue.push_back(i->to);
+        } else if(i->arrival < scratch.dist[i->to]){
+            scratch.reach(i->to, i->arrival, i->from);
+        }
+    }
+    std::sort(scratch.queue.begin(), scratch.queue.end(), [](StationIdx first, StationIdx second){
+        return scratch.dist[first] < scratch.dist[second];
+    });
+    for(std::size_t i = 0; i < scratch.queue.size(); i++){
+        scratch.via[scratch.queue[i]] = i;
+    }
+    for(auto station : scratch.queue){
+        result.stations.push_back(station_IDs[station]);
+        result.costs.push_back(scratch.dist[station] - starttime);
+        result.previous.push_back(station == from ? NO_VALUE : scratch.via[scratch.parent[station]]);
+    }
+    return true;
+}
+
+/**
+ * @brief Datastructures::build_distance_hierarchy, start answering route_shortest_distance from a contraction hierarchy
+ */
+void Datastructures::build_distance_hierarchy(){
+    WriteLock lock(*this);
+    hierarchy_enabled = true;
+    hierarchy_dirty = true;
+    update_hierarchy();
+}
+
+/**
+ * @brief Datastructures::update_hierarchy, rebuild the contraction hierarchy if it is in use and out of date
+ */
+void Datastructures::update_hierarchy() const{
+    if(!hierarchy_enabled || !hierarchy_dirty){
+        return;
+    }
+    update_links();
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!hierarchy_dirty){
+        return;
+    }
+    std::size_t n = station_IDs.size();
+    // Working graph in both directions, parallel links are merged into the shortest one
+    std::vector<std::vector<Shortcut>> out(n);
+    std::vector<std::vector<Shortcut>> in(n);
+    auto add_link = [&out, &in](StationIdx from, StationIdx to, Distance length, StationIdx middle){
+        for(auto &link : out[from]){
+            if(link.to == to){
+                if(length < link.length){
+                    link = {to, length, middle};
+                    for(auto &back : in[to]){
+                        if(back.to == from){
+                            back = {from, length, middle};
+                        }
+                    }
+                }
+                return;
+            }
+        }
+        out[from].push_back({to, length, middle});
+        in[to].push_back({from, length, middle});
+    };
+    for(StationIdx i = 0; i < n; i++){
+        for(auto link = forward_links.first[i]; link < forward_links.end[i]; link++){
+            if(forward_links.to[link] != i){
+                add_link(i, forward_links.to[link], forward_links.length[link], NO_INDEX);
+            }
+        }
+    }
+
+    // Contracted stations are taken out of the working graph, their remaining links are the
+    // ones going up the hierarchy
+    std::vector<std::vector<Shortcut>> up(n);
+    std::vector<std::vector<Shortcut>> down(n);
+    std::vector<int> contracted_neighbours(n, 0);
+    // Dijkstra from a neighbour of the station being contracted, avoiding that station
+    auto witness_search = [n, &out](StationIdx start, StationIdx avoid, Distance bound){
+        scratch.start(n);
+        scratch.reach(start, 0, NO_INDEX);
+        scratch.heap_push(start);
+        unsigned int settled = 0;
+        while(!scratch.heap.empty() && settled < WITNESS_LIMIT){
+            StationIdx current = scratch.heap_pop();
+            settled++;
+            for(auto &link : out[current]){
+                Distance length = scratch.dist[current] + link.length;
+                if(link.to == avoid || length > bound){
+                    continue;
+                }
+                if(!scratch.reached(link.to)){
+                    scratch.reach(link.to, length, current);
+                    scratch.heap_push(link.to);
+                } else if(scratch.heap_pos[link.to] != SearchScratch::SETTLED && length < scratch.dist[link.to]){
+                    scratch.reach(link.to, length, current);
+                    scratch.heap_decrease(link.to);
+                }
+            }
+        }
+    };
+    // Shortcuts contracting a station needs, a witness search that gives up only adds extra ones
+    std::vector<std::tuple<StationIdx, StationIdx, Distance>> shortcuts;
+    auto priority = [&](StationIdx station){
+        shortcuts.clear();
+        for(auto &incoming : in[station]){
+            Distance bound = -1;
+            for(auto &outgoing : out[station]){
+                if(outgoing.to != incoming.to){
+                    bound = std::max(bound, incoming.length + outgoing.length);
+                }
+            }
+            if(bound < 0){
+                continue;
+            }
+            witness_search(incoming.to, station, bound);
+            for(auto &outgoing : out[station]){
+                if(outgoing.to == incoming.to){
+                    continue;
+                }
+                Distance length = incoming.length + outgoing.length;
+                if(!scratch.reached(outgoing.to) || scratch.dist[outgoing.to] > length){
+                    shortcuts.push_back({incoming.to, outgoing.to, length});
+                }
+            }
+        }
+        int links = in[station].size() + out[station].size();
+        return static_cast<int>(shortcuts.size()) - links + contracted_neighbours[station];
+    };
+
+    // Contract stations cheapest first, priorities are refreshed when they come up
+    using Entry = std::pair<int, StationIdx>;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> order;
+    for(StationIdx i = 0; i < n; i++){
+        order.push({priority(i), i});
+    }
+    hierarchy_rank.assign(n, 0);
+    unsigned int rank = 0;
+    while(!order.empty()){
+        StationIdx station = order.top().second;
+        order.pop();
+        int current = priority(station);
+        if(!order.empty() && current > order.top().first){
+            order.push({current, station});
+            continue;
+        }
+        hierarchy_rank[station] = rank++;
+        auto is_station = [station](Shortcut const& link){return link.to == station;};
+        for(auto &link : out[station]){
+            auto &back = in[link.to];
+            back.erase(std::remove_if(back.begin(), back.end(), is_station), back.end());
+            contracted_neighbours[link.to]++;
+        }
+        for(auto &link : in[station]){
+            auto &back = out[link.to];
+            back.erase(std::remove_if(back.begin(), back.end(), is_station), back.end());
+            contracted_neighbours[link.to]++;
+        }
+        up[station] = std::move(out[station]);
+        down[station] = std::move(in[station]);
+        out[station].clear();
+        in[station].clear();
+        for(auto &[from, to, length] : shortcuts){
+            add_link(from, to, length, station);
+        }
+    }
+
+    // Links in down keep their start in to, which is what hierarchy_down expects
+    hierarchy_up_first.assign(n + 1, 0);
+    hierarchy_down_first.assign(n + 1, 0);
+    for(StationIdx i = 0; i < n; i++){
+        hierarchy_up_first[i + 1] = hierarchy_up_first[i] + up[i].size();
+        hierarchy_down_first[i + 1] = hierarchy_down_first[i] + down[i].size();
+    }
+    hierarchy_up.clear();
+    hierarchy_down.clear();
+    hierarchy_up.reserve(hierarchy_up_first[n]);
+    hierarchy_down.reserve(hierarchy_down_first[n]);
+    for(StationIdx i = 0; i < n; i++){
+        hierarchy_up.insert(hierarchy_up.end(), up[i].begin(), up[i].end());
+        hierarchy_down.insert(hierarchy_down.end(), down[i].begin(), down[i].end());
+    }
+    hierarchy_dirty = false;
+}
+
+/**
+ * @brief Datastructures::hierarchy_link, find a link or shortcut of the hierarchy
+ * @param from, start of the link
+ * @param to, end of the link
+ * @return the link, as stored at its lower ranked end
+ */
+Datastructures::Shortcut const& Datastructures::hierarchy_link(StationIdx from, StationIdx to) const{
+    if(hierarchy_rank[to] > hierarchy_rank[from]){
+        for(auto i = hierarchy_up_first[from]; i < hierarchy_up_first[from + 1]; i++){
+            if(hierarchy_up[i].to == to){
+                return hierarchy_up[i];
+            }
+        }
+    } else {
+        for(auto i = hierarchy_down_first[to]; i < hierarchy_down_first[to + 1]; i++){
+            if(hierarchy_down[i].to == from){
+                return hierarchy_down[i];
+            }
+        }
+    }
+    throw std::logic_error("hierarchy_link(): no such link");
+}
+
+/**
+ * @brief Datastructures::unpack_link, expand a link of the hierarchy into train links
+ * @param from, start of the link, already in path
+ * @param to, end of the link
+ * @param path, stations after from up to and including to are appended here
+ */
+void Datastructures::unpack_link(StationIdx from, StationIdx to, std::vector<StationIdx>& path) const{
+    // Shortcuts are split at their middle station until the next step is a train link
+    std::vector<StationIdx> pending = {to};
+    StationIdx current = from;
+    while(!pending.empty()){
+        StationIdx middle = hierarchy_link(current, pending.back()).middle;
+        if(middle == NO_INDEX){
+            current = pending.back();
+            path.push_back(current);
+            pending.pop_back();
+        } else {
+            pending.push_back(middle);
+        }
+    }
+}
+
+/**
+ * @brief Datastructures::route_in_hierarchy, shortest route by searching upwards from both ends
+ * @param from, start station
+ * @param to, destination station
+ * @return all stations of the route in order with cumulative distances, empty if there is no route
+ */
+std::vector<std::pair<StationID, Distance>> Datastructures::route_in_hierarchy(StationIdx from, StationIdx to) const{
+    auto &forward = scratch;
+    auto &backward = reverse_scratch;
+    forward.start(station_IDs.size());
+    backward.start(station_IDs.size());
+    forward.reach(from, 0, NO_INDEX);
+    forward.heap_push(from);
+    backward.reach(to, 0, NO_INDEX);
+    backward.heap_push(to);
+    Distance best = std::numeric_limits<Distance>::max();
+    StationIdx meeting = NO_INDEX;
+    // A search stops once its nearest unsettled station is no closer than the best route
+    while(true){
+        bool forward_open = !forward.heap.empty() && forward.key[forward.heap.front()] < best;
+        bool backward_open = !backward.heap.empty() && backward.key[backward.heap.front()] < best;
+        if(!forward_open && !backward_open){
+            break;
+        }
+        bool go_forward = forward_open
+                && (!backward_open || forward.key[forward.heap.front()] <= backward.key[backward.heap.front()]);
+        auto &search = go_forward ? forward : backward;
+        auto &other = go_forward ? backward : forward;
+        auto &first = go_forward ? hierarchy_up_first : hierarchy_down_first;
+        auto &links = go_forward ? hierarchy_up : hierarchy_down;
+        StationIdx current = search.heap_pop();
+        for(auto i = first[current]; i < first[current + 1]; i++){
+            auto &link = links[i];
+            Distance length = search.dist[current] + link.length;
+            if(!search.reached(link.to)){
+                search.reach(link.to, length, current);
+                search.heap_push(link.to);
+            } else if(search.heap_pos[link.to] != SearchScratch::SETTLED && length < search.dist[link.to]){
+                search.reach(link.to, length, current);
+                search.heap_decrease(link.to);
+            }
+        }
+        if(other.reached(current) && search.dist[current] + other.dist[current] < best){
+            best = search.dist[current] + other.dist[current];
+            meeting = current;
+        }
+    }
+    last_settled = forward.settled + backward.settled;
+    if(meeting == NO_INDEX){
+        return {};
+    }
+
+    std::vector<StationIdx> upward;
+    for(auto station = meeting; station != NO_INDEX; station = forward.parent[station]){
+        upward.push_back(station);
+    }
+    std::vector<StationIdx> path = {from};
+    for(std::size_t i = upward.size() - 1; i > 0; i--){
+        unpack_link(upward[i], upward[i-1], path);
+    }
+    for(auto station = meeting; backward.parent[station] != NO_INDEX; station = backward.parent[station]){
+        unpack_link(station, backward.parent[station], path);
+    }
+    return route_from_path(path);
+}
+
+/**
+ * @brief Datastructures::build_landmarks, choose landmarks that tighten the estimates of goal directed searches
+ * @param count, number of landmarks, 0 leaves only the straight line estimate
+ */
+void Datastructures::build_landmarks(unsigned int count){
+    WriteLock lock(*this);
+    landmark_count = count;
+    goal_dirty = true;
+    update_goal_bounds();
+}
+
+/**
+ * @brief Datastructures::set_goal_directed, choose between A* and plain Dijkstra in route_shortest_distance
+ * @param enabled, true to use the distance estimates
+ */
+void Datastructures::set_goal_directed(bool enabled){
+    WriteLock lock(*this);
+    goal_directed = enabled;
+}
+
+/**
+ * @brief Datastructures::last_route_settled, how much work the last distance query of this thread did
+ * @return number of stations settled by the last route_shortest_distance of the calling thread
+ */
+unsigned int Datastructures::last_route_settled() const{
+    return last_settled;
+}
+
+/**
+ * @brief Datastructures::update_goal_bounds, recompute the estimate scale and landmark distances if links changed
+ */
+void Datastructures::update_goal_bounds() const{
+    if(!goal_dirty){
+        return;
+    }
+    update_links();
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!goal_dirty){
+        return;
+    }
+    // Truncating shortens a link by less than one, which is a fraction of its straight line
+    double scale = 1;
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        for(auto link = forward_links.first[i]; link < forward_links.end[i]; link++){
+            double line = straight_line(station_coords[i], station_coords[forward_links.to[link]]);
+            if(line > 0){
+                scale = std::min(scale, forward_links.length[link] / line);
+            }
+        }
+    }
+    // Keeps rounding from pushing an estimate over the real distance
+    heuristic_scale = scale * (1 - 1e-9);
+
+    std::size_t n = station_IDs.size();
+    landmark_from.assign(n * landmark_count, NO_DISTANCE);
+    landmark_to.assign(n * landmark_count, NO_DISTANCE);
+    if(landmark_count > 0 && n > 0){
+        // The first landmark is the station furthest from some station, after that always
+        // the station furthest from every landmark so far. Stations without links are skipped.
+        auto linked = [this](StationIdx station){
+            return !station_removed[station] && (forward_links.first[station] != forward_links.end[station]
+                                                 || backward_links.first[station] != backward_links.end[station]);
+        };
+        std::vector<double> furthest(n, 0);
+        StationIdx first = 0;
+        while(first < n && !linked(first)){
+            first++;
+        }
+        for(StationIdx i = 0; i < n && first < n; i++){
+            if(linked(i)){
+                furthest[i] = straight_line(station_coords[first], station_coords[i]);
+            }
+        }
+        for(unsigned int slot = 0; slot < landmark_count; slot++){
+            auto landmark = std::max_element(furthest.begin(), furthest.end()) - furthest.begin();
+            if(!linked(landmark) || (slot > 0 && furthest[landmark] == 0)){
+                break;
+            }
+            landmark_distances(landmark, false, slot);
+            landmark_distances(landmark, true, slot);
+            for(StationIdx i = 0; i < n; i++){
+                Distance from_landmark = landmark_from[i * landmark_count + slot];
+                if(!linked(i)){
+                    furthest[i] = 0;
+                } else if(slot == 0){
+                    // Stations the landmark can't reach are the best next landmarks
+                    furthest[i] = from_landmark == NO_DISTANCE ? std::numeric_limits<double>::max() : from_landmark;
+                } else if(from_landmark != NO_DISTANCE){
+                    furthest[i] = std::min<double>(furthest[i], from_landmark);
+                }
+            }
+            furthest[landmark] = 0;
+        }
+    }
+    goal_dirty = false;
+}
+
+/**
+ * @brief Datastructures::landmark_distances, Dijkstra from or to a landmark over train links
+ * @param landmark, station used as the landmark
+ * @param reverse, false for distances from the landmark, true for distances to it
+ * @param slot, landmark number in landmark_from and landmark_to
+ */
+void Datastructures::landmark_distances(StationIdx landmark, bool reverse, unsigned int slot) const{
+    auto &distances = reverse ? landmark_to : landmark_from;
+    auto &links = reverse ? backward_links : forward_links;
+    scratch.start(station_IDs.size());
+    scratch.reach(landmark, 0, NO_INDEX);
+    scratch.heap_push(landmark);
+    auto relax = [](StationIdx current, StationIdx station, Distance link_length){
+        Distance length = scratch.dist[current] + link_length;
+        if(!scratch.reached(station)){
+            scratch.reach(station, length, current);
+            scratch.heap_push(station);
+        } else if(scratch.heap_pos[station] != SearchScratch::SETTLED && length < scratch.dist[station]){
+            scratch.reach(station, length, current);
+            scratch.heap_decrease(station);
+        }
+    };
+    while(!scratch.heap.empty()){
+        StationIdx current = scratch.heap_pop();
+        distances[current * landmark_count + slot] = scratch.dist[current];
+        for(auto link = links.first[current]; link < links.end[current]; link++){
+            relax(current, links.to[link], links.length[link]);
+        }
+    }
+}
+
+/**
+ * @brief Datastructures::distance_estimate, lower bound for the distance between two stations
+ * @param station, station where the rest of the route starts
+ * @param to, destination
+ * @return the best of the straight line and landmark bounds, 0 if goal directed search is off
+ */
+Distance Datastructures::distance_estimate(StationIdx station, StationIdx to) const{
+    if(!goal_directed){
+        return 0;
+    }
+    Distance estimate = heuristic_scale * straight_line(station_coords[station], station_coords[to]);
+    // Triangle inequalities through every landmark, both directions
+    auto from_station = landmark_from.begin() + station * landmark_count;
+    auto from_to = landmark_from.begin() + to * landmark_count;
+    auto to_station = landmark_to.begin() + station * landmark_count;
+    auto to_to = landmark_to.begin() + to * landmark_count;
+    for(unsigned int i = 0; i < landmark_count; i++){
+        if(from_station[i] != NO_DISTANCE && from_to[i] != NO_DISTANCE){
+            estimate = std::max(estimate, from_to[i] - from_station[i]);
+        }
+        if(to_station[i] != NO_DISTANCE && to_to[i] != NO_DISTANCE){
+            estimate = std::max(estimate, to_station[i] - to_to[i]);
+        }
+    }
+    return estimate;
+}
+
+/**
+ * @brief Datastructures::connection_before, order of connections in the connection scan
+ * @param first, connection to compare
+ * @param second, connection to compare
+ * @return true if first departs before second, hops of one train stay in route order
+ */
+bool Datastructures::connection_before(Connection const& first, Connection const& second){
+    return std::tie(first.departure, first.arrival, first.train, first.stop)
+            < std::tie(second.departure, second.arrival, second.train, second.stop);
+}
+
+/**
+ * @brief Datastructures::append_connections, add the hops of a train to the unsorted end of connections
+ * @param train, added train
+ */
+void Datastructures::append_connections(TrainIdx train) const{
+    // A rebuild from train_stops is coming anyway
+    if(connections_stale){
+        return;
+    }
+    auto &stops = train_stops[train];
+    connection_tail[train] = connections.size();
+    for(unsigned int i = 0; i + 1 < stops.size(); i++){
+        // A hop arriving before it departs can't be ridden
+        if(stops[i+1].second >= stops[i].second){
+            connections.push_back({stops[i].second, stops[i+1].second, stops[i].first, stops[i+1].first, train, i});
+        }
+    }
+    connections_dirty = true;
+}
+
+/**
+ * @brief Datastructures::retire_connections, mark the connections of a train for removal before its stops change
+ * @param train, train whose current stops the connections were made from
+ */
+void Datastructures::retire_connections(TrainIdx train){
+    if(connections_stale){
+        return;
+    }
+    auto &stops = train_stops[train];
+    auto retire = [this](Connection& connection){
+        connection.from = NO_INDEX;
+        connections_retired++;
+    };
+    if(connection_tail[train] != NO_INDEX){
+        // Still in the unsorted tail, where they were appended one after another
+        for(auto i = connection_tail[train]; i < connections.size() && connections[i].train == train; i++){
+            retire(connections[i]);
+        }
+        connection_tail[train] = NO_INDEX;
+    } else {
+        auto sorted_end = connections.begin() + connections_sorted;
+        for(unsigned int i = 0; i + 1 < stops.size(); i++){
+            if(stops[i+1].second < stops[i].second){
+                continue;
+            }
+            Connection hop{stops[i].second, stops[i+1].second, stops[i].first, stops[i+1].first, train, i};
+            auto found = std::lower_bound(connections.begin(), sorted_end, hop, connection_before);
+            if(found != sorted_end && !connection_before(hop, *found)){
+                retire(*found);
+            }
+        }
+    }
+    connections_dirty = true;
+}
+
+/**
+ * @brief Datastructures::update_connections, bring connections into departure order if needed
+ */
+void Datastructures::update_connections() const{
+    if(!connections_dirty){
+        return;
+    }
+    std::lock_guard<std::mutex> rebuild(lazy_mutex);
+    if(!connections_dirty){
+        return;
+    }
+    if(connections_stale){
+        connections.clear();
+        connections_sorted = 0;
+        connections_retired = 0;
+        connections_stale = false;
+        std::fill(connection_tail.begin(), connection_tail.end(), NO_INDEX);
+        for(TrainIdx train = 0; train < train_stops.size(); train++){
+            if(train_added[train]){
+                append_connections(train);
+            }
+        }
+    }
+    if(connections_retired > 0){
+        // Removing keeps the order of both the sorted part and the tail
+        std::size_t kept = 0;
+        std::size_t kept_sorted = 0;
+        for(std::size_t i = 0; i < connections.size(); i++){
+            if(connections[i].from != NO_INDEX){
+                connections[kept++] = connections[i];
+                if(i < connections_sorted){
+                    kept_sorted = kept;
+                }
+            }
+        }
+        connections.resize(kept);
+        connections_sorted = kept_sorted;
+        connections_retired = 0;
+    }
+    if(connections_sorted < connections.size()){
+        merge_unsorted_tail(connections, connections_sorted, connection_before);
+        std::fill(connection_tail.begin(), connection_tail.end(), NO_INDEX);
+    }
+    connections_dirty = false;
+}
+
+/**
+ * @brief Datastructures::route_earliest_arrival, route that arrives first when leaving at starttime or later
+ * @param fromid station where to start the search
+ * @param toid station where to stop the search
+ * @param starttime earliest time to leave
+ * @return stations of the route with departure times, the last one with arrival time, empty if there is no route
+ */
+std::vector<std::pair<StationID, Time>> Datastructures::route_earliest_arrival(StationID fromid, StationID toid, Time starttime) const
+{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{NO_STATION, NO_TIME}};
+    }
+    RouteKey key{from, to, RouteQuery::EARLIEST_ARRIVAL, starttime};
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        if(CachedRoute* cached = find_cached_route(key)){
+            return cached->timed_route;
+        }
+    }
+    auto route = earliest_arrival_route(from, to, starttime);
+    if(route_cache_counts.capacity > 0){
+        std::lock_guard<std::mutex> guard(route_cache_mutex);
+        store_cached_route(key).timed_route = route;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::earliest_arrival_route, connection scan for route_earliest_arrival
+ * @param from, station where to start the search
+ * @param to, station where to stop the search
+ * @param starttime earliest time to leave
+ * @return stations of the route with departure times, the last one with arrival time, empty if there is no route
+ */
+std::vector<std::pair<StationID, Time>> Datastructures::earliest_arrival_route(StationIdx from, StationIdx to, Time starttime) const{
+    if(from == to){
+        return {};
+    }
+    update_components();
+    if(!may_reach(from, to)){
+        return {};
+    }
+    update_connections();
+    // dist holds the earliest arrival time of each reached station
+    scratch.start(station_IDs.size(), train_IDs.size());
+    scratch.reach(from, starttime, NO_INDEX);
+    auto first = std::lower_bound(connections.begin(), connections.end(), starttime,
+                                  [](Connection const& connection, Time value){return connection.departure < value;});
+    for(auto i = first; i != connections.end(); i++){
+        // Every later connection departs no earlier, so none of them can improve the arrival
+        if(scratch.reached(to) && i->departure >= scratch.dist[to]){
+            break;
+        }
+        if(!scratch.riding(i->train, i->stop)){
+            if(!scratch.reached(i->from) || scratch.dist[i->from] > i->departure){
+                continue;
+            }
+        }
+        scratch.ride(i->train, i->stop);
+        if(!scratch.reached(i->to) || i->arrival < scratch.dist[i->to]){
+            scratch.reach(i->to, i->arrival, i->from);
+            scratch.via[i->to] = i - connections.begin();
+        }
+    }
+    if(!scratch.reached(to)){
+        return {};
+    }
+
+    // Arrivals only improve strictly, so following parents always leads back to the start
+    std::size_t length = 1;
+    for(auto station = to; station != from; station = scratch.parent[station]){
+        length++;
+    }
+    std::vector<std::pair<StationID, Time>> route(length);
+    route.back() = {station_IDs[to], scratch.dist[to]};
+    auto station = to;
+    for(std::size_t i = length - 1; i-- > 0;){
+        auto &connection = connections[scratch.via[station]];
+        route[i] = {station_IDs[connection.from], connection.departure};
+        station = connection.from;
+    }
+    return route;
+}
+
+/**
+ * @brief Datastructures::train_stop_position, find the stop of a train at a station
+ * @param train, train whose route is searched
+ * @param station, station of the stop
+ * @param time, departure time of the train from the station
+ * @return position of the stop in train_stops, NO_INDEX if the train doesn't stop there then
+ */
+unsigned int Datastructures::train_stop_position(TrainIdx train, StationIdx station, Time time) const{
+    auto found_stop = stop_index.find(stop_key(station, train));
+    if(found_stop == stop_index.end()){
+        return NO_INDEX;
+    }
+    // Only a train passing the station more than once has to look further than the first stop
+    auto &stops = train_stops[train];
+    for(unsigned int i = found_stop->second; i < stops.size(); i++){
+        if(stops[i].first == station && stops[i].second == time){
+            return i;
+        }
+    }
+    return NO_INDEX;
+}
+
+/**
+ * @brief Datastructures::journeys_pareto, journeys that are not beaten in both arrival time and number of trains
+ * @param fromid station where to start the search
+ * @param toid station where to stop the search
+ * @param starttime earliest time to leave
+ * @param max_trains most trains one journey may use
+ * @return journeys as lists of train rides, fewest trains (and latest arrival) first
+ */
+std::vector<std::vector<JourneyLeg>> Datastructures::journeys_pareto(StationID fromid, StationID toid, Time starttime,
+                                                                     unsigned int max_trains) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{JourneyLeg{NO_STATION, NO_TRAIN, NO_TIME, NO_STATION, NO_TIME}}};
+    }
+    if(from == to){
+        return {};
+    }
+    update_components();
+    if(!may_reach(from, to)){
+        return {};
+    }
+    // A label is one ride that improved the arrival at its alighting station, previous is the
+    // label that brought the passenger to the boarding station (NO_INDEX at the start)
+    struct Label{
+        TrainIdx train;
+        unsigned int board;
+        unsigned int alight;
+        unsigned int previous;
+    };
+    std::vector<Label> labels;
+    // dist is the earliest arrival with the trains of rounds so far, parent the label giving it
+    scratch.start(station_IDs.size(), train_IDs.size());
+    scratch.reach(from, starttime, NO_INDEX);
+    std::vector<StationIdx> marked = {from};
+    std::vector<TrainIdx> trains;
+    // Earliest reachable stop of every queued train and the label it is boarded from
+    std::vector<std::pair<unsigned int, unsigned int>> boarding;
+    std::vector<std::vector<JourneyLeg>> journeys;
+
+    for(unsigned int round = 0; round < max_trains && !marked.empty(); round++){
+        // Collect trains leaving the stations improved last round, the earliest stop wins since
+        // staying on board never arrives anywhere later
+        trains.clear();
+        boarding.clear();
+        for(auto station : marked){
+            Time ready = scratch.dist[station];
+            auto &departures = station_departures[station];
+            auto first = std::lower_bound(departures.begin(), departures.end(), ready,
+                                          [](std::pair<Time, TrainIdx> const& departure, Time value)
+                                            {return departure.first < value;});
+            for(auto i = first; i != departures.end(); i++){
+                if(scratch.reached(to) && i->first >= scratch.dist[to]){
+                    break;
+                }
+                if(!train_added[i->second]){
+                    continue;
+                }
+                unsigned int position = train_stop_position(i->second, station, i->first);
+                if(position == NO_INDEX){
+                    continue;
+                }
+                auto &slot = scratch.train_slot[i->second];
+                if(slot == NO_INDEX){
+                    slot = trains.size();
+                    trains.push_back(i->second);
+                    boarding.push_back({position, scratch.parent[station]});
+                } else if(position < boarding[slot].first){
+                    boarding[slot] = {position, scratch.parent[station]};
+                }
+            }
+        }
+
+        // Ride every collected train onwards, boarding labels were all taken before any update
+        Time best = scratch.reached(to) ? scratch.dist[to] : NO_TIME;
+        marked.clear();
+        for(unsigned int slot = 0; slot < trains.size(); slot++){
+            TrainIdx train = trains[slot];
+            scratch.train_slot[train] = NO_INDEX;
+            auto &stops = train_stops[train];
+            auto [position, previous] = boarding[slot];
+            for(unsigned int i = position + 1; i < stops.size(); i++){
+                Time arrival = stops[i].second;
+                // Times going backwards can't be ridden, and later stops can't beat the destination
+                if(arrival < stops[i-1].second || (scratch.reached(to) && arrival >= scratch.dist[to])){
+                    break;
+                }
+                StationIdx station = stops[i].first;
+                if(!scratch.reached(station) || arrival < scratch.dist[station]){
+                    labels.push_back({train, position, i, previous});
+                    scratch.reach(station, arrival, labels.size() - 1);
+                    marked.push_back(station);
+                }
+            }
+        }
+        std::sort(marked.begin(), marked.end());
+        marked.erase(std::unique(marked.begin(), marked.end()), marked.end());
+
+        if(scratch.reached(to) && scratch.dist[to] != best){
+            std::vector<JourneyLeg> journey;
+            for(auto label = scratch.parent[to]; label != NO_INDEX; label = labels[label].previous){
+                auto &ride = labels[label];
+                auto &stops = train_stops[ride.train];
+                journey.push_back({station_IDs[stops[ride.board].first], train_IDs[ride.train], stops[ride.board].second,
+                                   station_IDs[stops[ride.alight].first], stops[ride.alight].second});
+            }
+            std::reverse(journey.begin(), journey.end());
+            // The new journey arrives earlier, so any earlier one with as many trains is dominated
+            while(!journeys.empty() && journeys.back().size() >= journey.size()){
+                journeys.pop_back();
+            }
+            journeys.push_back(std::move(journey));
+        }
+    }
+    return journeys;
+}
+
+/**
+ * @brief Datastructures::journeys_profile, every journey worth taking that leaves within a time window
+ * @param fromid station where to start the journeys
+ * @param toid station where to end the journeys
+ * @param starttime earliest time to leave
+ * @param endtime latest time to leave
+ * @return departure and arrival times by departure, each arriving earlier than any journey leaving before it
+ */
+std::vector<std::pair<Time, Time>> Datastructures::journeys_profile(StationID fromid, StationID toid, Time starttime, Time endtime) const{
+    ReadLock lock(*this);
+    StationIdx from = find_station(fromid);
+    StationIdx to = find_station(toid);
+    if(from == NO_INDEX || to == NO_INDEX){
+        return {{NO_TIME, NO_TIME}};
+    }
+    if(from == to || starttime > endtime){
+        return {};
+    }
+    update_links();
+    update_components();
+    if(!may_reach(from, to)){
+        return {};
+    }
+    update_connections();
+    // Going backwards in time, profiles[station] holds departures from the station with the
+    // earliest arrival at the destination after them, both getting earlier towards the back.
+    // train_arrival is the arrival reachable by staying on the train from stop train_stop on,
+    // which helps only the hop to that stop, as a hop dropped from connections breaks the ride.
+    unsigned int const unreached = std::numeric_limits<unsigned int>::max();
+    std::vector<std::vector<std::pair<Time, Time>>> profiles(station_IDs.size());
+    std::vector<unsigned int> train_arrival(train_IDs.size(), unreached);
+    std::vector<unsigned int> train_stop(train_IDs.size(), NO_INDEX);
+    auto first = std::lower_bound(connections.begin(), connections.end(), starttime,
+                                  [](Connection const& connection, Time value){return connection.departure < value;});
+    for(auto i = connections.end(); i != first; ){
+        --i;
+        unsigned int arrival = i->to == to ? i->arrival : unreached;
+        if(train_stop[i->train] == i->stop + 1){
+            arrival = std::min(arrival, train_arrival[i->train]);
+        }
+        // Changing trains: the earliest arrival of the journeys leaving i->to after i arrives
+        auto &next = profiles[i->to];
+        auto later = std::partition_point(next.begin(), next.end(),
+                                          [i](std::pair<Time, Time> const& journey){return journey.first >= i->arrival;});
+        if(later != next.begin()){
+            arrival = std::min<unsigned int>(arrival, std::prev(later)->second);
+        }
+        if(arrival == unreached){
+            continue;
+        }
+        train_arrival[i->train] = arrival;
+        train_stop[i->train] = i->stop;
+        auto &profile = profiles[i->from];
+        if(!profile.empty() && profile.back().second <= arrival){
+            continue;
+        }
+        if(!profile.empty() && profile.back().first == i->departure){
+            profile.back().second = arrival;
+        } else {
+            profile.push_back({i->departure, static_cast<Time>(arrival)});
+        }
+    }
+    std::vector<std::pair<Time, Time>> journeys;
+    for(auto journey = profiles[from].rbegin(); journey != profiles[from].rend() && journey->first <= endtime; journey++){
+        journeys.push_back(*journey);
+    }
+    return journeys;
+}
+
+/**
+ * @brief Datastructures::route_matrix, fewest stations routes from every source to every target
+ * @param sources, station IDs of the rows
+ * @param targets, station IDs of the columns
+ * @param progress, called with the number of finished sources and the number of all sources
+ * @return hop counts and distances, unknown stations get NO_VALUE and NO_DISTANCE
+ */
+RouteMatrix Datastructures::route_matrix(std::vector<StationID> const& sources, std::vector<StationID> const& targets,
+                                         std::function<void(std::size_t, std::size_t)> const& progress) const{
+    ReadLock lock(*this);
+    RouteMatrix matrix;
+    matrix.sources = sources.size();
+    matrix.targets = targets.size();
+    matrix.hops.assign(sources.size() * targets.size(), NO_VALUE);
+    matrix.distances.assign(sources.size() * targets.size(), NO_DISTANCE);
+
+    // Column of every target station, a station given twice is searched once and copied
+    std::vector<StationIdx> columns(targets.size());
+    std::vector<unsigned int> column_of(station_IDs.size(), NO_INDEX);
+    std::vector<std::pair<std::size_t, std::size_t>> copies;
+    std::size_t distinct = 0;
+    for(std::size_t i = 0; i < targets.size(); i++){
+        columns[i] = find_station(targets[i]);
+        if(columns[i] == NO_INDEX){
+            continue;
+        }
+        if(column_of[columns[i]] == NO_INDEX){
+            column_of[columns[i]] = i;
+            distinct++;
+        } else {
+            copies.push_back({column_of[columns[i]], i});
+        }
+    }
+
+    // Worker threads only read the network, the lock held by this thread keeps writers out.
+    // Sources are handed out one at a time, BFS from different stations take very different time.
+    update_links();
+    auto &links = forward_links;
+    std::atomic<std::size_t> next_source{0};
+    std::size_t done = 0;
+    std::mutex progress_mutex;
+    // An exception from progress stops the workers and is thrown again from this thread
+    std::exception_ptr progress_error;
+    std::size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    parallel_for(std::min(workers, sources.size()), [&](std::size_t, std::size_t){
+        ReadLock worker_lock(*this, true);
+        for(std::size_t row = next_source++; row < sources.size(); row = next_source++){
+            StationIdx source = find_station(sources[row]);
+            if(source != NO_INDEX){
+                scratch.start(station_IDs.size());
+                scratch.reach(source, 0, NO_INDEX);
+                scratch.queue.push_back(source);
+                std::size_t remaining = distinct - (column_of[source] == NO_INDEX ? 0 : 1);
+                for(std::size_t head = 0; head < scratch.queue.size() && remaining > 0; head++){
+                    StationIdx current = scratch.queue[head];
+                    for(auto link = links.first[current]; link < links.end[current]; link++){
+                        StationIdx station = links.to[link];
+                        if(!scratch.reached(station)){
+                            scratch.reach(station, scratch.dist[current] + 1, current);
+                            scratch.queue.push_back(station);
+                            if(column_of[station] != NO_INDEX){
+                                remaining--;
+                            }
+                        }
+                    }
+                }
+                auto hops = matrix.hops.begin() + row * targets.size();
+                auto distances = matrix.distances.begin() + row * targets.size();
+                for(std::size_t column = 0; column < targets.size(); column++){
+                    StationIdx target = columns[column];
+                    if(target == NO_INDEX || column_of[target] != column || !scratch.reached(target)){
+                        continue;
+                    }
+                    hops[column] = scratch.dist[target];
+                    Distance length = 0;
+                    for(auto station = target; scratch.parent[station] != NO_INDEX; station = scratch.parent[station]){
+                        length += distance(station_coords[scratch.parent[station]], station_coords[station]);
+                    }
+                    distances[column] = length;
+                }
+                for(auto &[original, copy] : copies){
+                    hops[copy] = hops[original];
+                    distances[copy] = distances[original];
+                }
+            }
+            if(progress){
+                std::lock_guard<std::mutex> guard(progress_mutex);
+                try{
+                    if(!progress_error){
+                        progress(++done, sources.size());
+                    }
+                } catch(...){
+                    progress_error = std::current_exception();
+                    next_source = sources.size();
+                }
+            }
+        }
+    }, 1);
+    if(progress_error){
+        std::rethrow_exception(progress_error);
+    }
+    return matrix;
+}
+
+/**
+ * @brief Datastructures::add_stations_bulk, add many stations at once
+ * @param stations, id, name and coordinates of every new station
+ * @return how many stations were added, IDs that already exist are skipped
+ */
+unsigned int Datastructures::add_stations_bulk(std::vector<std::tuple<StationID, Name, Coord>> const& stations){
+    WriteLock lock(*this);
+    std::size_t total = station_IDs.size() + stations.size();
+    station_index.reserve(total);
+    station_IDs.reserve(total);
+    station_names.reserve(total);
+    station_coords.reserve(total);
+    station_region.reserve(total);
+    station_region_position.reserve(total);
+    station_departures.reserve(total);
+    station_next.reserve(total);
+    station_previous.reserve(total);
+    station_removed.reserve(total);
+    alphabetical_order.reserve(total);
+    coordinates.reserve(total);
+    nearest_pending.reserve(nearest_pending.size() + stations.size());
+
+    // Same as add_station, but the lazy indexes are marked out of date once for the whole batch
+    unsigned int added = 0;
+    for(auto &[id, name, xy] : stations){
+        StationIdx station = station_IDs.size();
+        if(!station_index.insert({id, station}).second){
+            continue;
+        }
+        station_IDs.push_back(id);
+        station_names.push_back(name);
+        station_coords.push_back(xy);
+        station_region.push_back(NO_INDEX);
+        station_region_position.push_back(NO_INDEX);
+        station_departures.emplace_back();
+        station_next.emplace_back();
+        station_previous.emplace_back();
+        station_removed.push_back(false);
+        alphabetical_order.push_back(station);
+        coordinates.push_back(station);
+        grid[grid_cell(xy)].push_back(station);
+        nearest_pending.push_back(station);
+        added++;
+    }
+    if(added > 0){
+        alphabetical_dirty = true;
+        coordinates_dirty = true;
+        nearest_changed();
+        links_changed();
+    }
+    return added;
+}
+
+/**
+ * @brief Datastructures::add_regions_bulk, add many regions at once
+ * @param regions, id, name and coordinates of every new region
+ * @return how many regions were added, IDs that already exist are skipped
+ */
+unsigned int Datastructures::add_regions_bulk(std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> const& regions){
+    WriteLock lock(*this);
+    std::size_t total = region_IDs.size() + regions.size();
+    region_index.reserve(total);
+    region_IDs.reserve(total);
+    region_names.reserve(total);
+    region_coords.reserve(total);
+    region_parent.reserve(total);
+    region_depth.reserve(total);
+    region_bounds.reserve(total);
+    region_subregions.reserve(total);
+    region_stations.reserve(total);
+
+    // Same as add_region, but the ancestor table grows and the lazy indexes are marked out
+    // of date once for the whole batch
+    unsigned int added = 0;
+    for(auto &[id, name, coords] : regions){
+        if(!region_index.insert({id, static_cast<RegionIdx>(region_IDs.size())}).second){
+            continue;
+        }
+        region_IDs.push_back(id);
+        region_names.push_back(name);
+        region_bounds.push_back(bounding_box(coords));
+        region_coords.push_back(coords);
+        region_parent.push_back(NO_INDEX);
+        region_subregions.emplace_back();
+        region_stations.emplace_back();
+        region_depth.push_back(0);
+        added++;
+    }
+    if(added > 0){
+        for(auto &level : region_up){
+            level.resize(region_IDs.size(), NO_INDEX);
+        }
+        region_tree_dirty = true;
+        euler_dirty = true;
+    }
+    return added;
+}
+
+/**
+ * @brief Datastructures::add_stations_to_regions_bulk, add many stations into regions at once
+ * @param pairs, station and the region it is added to
+ * @return how many stations were added, pairs that add_station_to_region would refuse are skipped
+ */
+unsigned int Datastructures::add_stations_to_regions_bulk(std::vector<std::pair<StationID, RegionID>> const& pairs){
+    WriteLock lock(*this);
+    unsigned int added = 0;
+    for(auto &[id, parentid] : pairs){
+        if(add_station_to_region(id, parentid)){
+            added++;
+        }
+    }
+    return added;
+}
+
+/**
+ * @brief Datastructures::add_trains_bulk, add many trains at once
+ * @param trains, train ID and its stations and times, like in add_train
+ * @return how many trains were added, trains that add_train would refuse are skipped
+ */
+unsigned int Datastructures::add_trains_bulk(std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> const& trains){
+    WriteLock lock(*this);
+    // Resolve station IDs of every train in parallel, lookups only read station_index
+    std::vector<std::vector<std::pair<StationIdx, Time>>> resolved(trains.size());
+    parallel_for(trains.size(), [this, &trains, &resolved](std::size_t begin, std::size_t end){
+        for(std::size_t i = begin; i < end; i++){
+            auto &stops = resolved[i];
+            stops.reserve(trains[i].second.size());
+            for(auto &[id, time] : trains[i].second){
+                auto found_id = station_index.find(id);
+                if(found_id == station_index.end()){
+                    stops.clear();
+                    break;
+                }
+                stops.push_back({found_id->second, time});
+            }
+        }
+    });
+
+    // Count new links and departures per station so every vector grows only once
+    std::vector<unsigned int> next_count(station_IDs.size(), 0);
+    std::vector<unsigned int> previous_count(station_IDs.size(), 0);
+    std::vector<unsigned int> departure_count(station_IDs.size(), 0);
+    for(auto &stops : resolved){
+        for(std::size_t i = 0; i < stops.size(); i++){
+            departure_count[stops[i].first]++;
+            if(i + 1 < stops.size()){
+                next_count[stops[i].first]++;
+                previous_count[stops[i+1].first]++;
+            }
+        }
+    }
+    std::vector<StationIdx> touched;
+    for(StationIdx i = 0; i < station_IDs.size(); i++){
+        if(departure_count[i] > 0){
+            station_next[i].reserve(station_next[i].size() + next_count[i]);
+            station_previous[i].reserve(station_previous[i].size() + previous_count[i]);
+            station_departures[i].reserve(station_departures[i].size() + departure_count[i]);
+            touched.push_back(i);
+        }
+    }
+    train_index.reserve(train_IDs.size() + trains.size());
+
+    unsigned int added = 0;
+    for(std::size_t t = 0; t < trains.size(); t++){
+        auto &stops = resolved[t];
+        auto found_train = train_index.find(trains[t].first);
+        if(stops.empty() || (found_train != train_index.end() && train_added[found_train->second])){
+            continue;
+        }
+        TrainIdx train = intern_train(trains[t].first);
+        for(std::size_t i = 0; i < stops.size(); i++){
+            // Departures are only appended here and sorted once below
+            station_departures[stops[i].first].push_back({stops[i].second, train});
+            if(i + 1 < stops.size()){
+                station_next[stops[i].first].push_back({train, stops[i+1].first});
+                station_previous[stops[i+1].first].push_back({train, stops[i].first});
+            }
+        }
+        train_stops[train] = std::move(stops);
+        train_added[train] = true;
+        index_stops(train);
+        append_connections(train);
+        added++;
+    }
+    if(added > 0){
+        links_changed();
+    }
+
+    // Sorting different stations touches disjoint vectors, so it can be done in parallel
+    parallel_for(touched.size(), [this, &touched](std::size_t begin, std::size_t end){
+        auto lambda = [this](std::pair<Time, TrainIdx> const& first, std::pair<Time, TrainIdx> const& second)
+                        {return departure_before(first, second);};
+        for(std::size_t i = begin; i < end; i++){
+            auto &departures = station_departures[touched[i]];
+            std::stable_sort(departures.begin(), departures.end(), lambda);
+        }
+    });
+    return added;
+}
+
+// Snapshot file layout: magic, version and then arrays, each written as its element count
+// followed by the raw elements. Nested vectors are written as an offset array and one flat
+// array, strings as an offset array and their characters.
+char const SNAPSHOT_MAGIC[8] = {'T', 'R', 'A', 'I', 'N', 'S', 'N', 'P'};
+std::uint32_t const SNAPSHOT_VERSION = 2;
+
+struct SnapshotWriter
+{
+    std::ofstream file;
+
+    template <typename Type>
+    void write_value(Type value)
+    {
+        file.write(reinterpret_cast<char const*>(&value), sizeof(Type));
+    }
+
+    template <typename Type>
+    void write_array(std::vector<Type> const& values)
+    {
+        write_value<std::uint64_t>(values.size());
+        file.write(reinterpret_cast<char const*>(values.data()), values.size() * sizeof(Type));
+    }
+
+    template <typename Type>
+    void write_nested(std::vector<std::vector<Type>> const& values)
+    {
+        std::vector<std::uint64_t> offsets = {0};
+        std::vector<Type> flat;
+        for(auto &inner : values){
+            flat.insert(flat.end(), inner.begin(), inner.end());
+            offsets.push_back(flat.size());
+        }
+        write_array(offsets);
+        write_array(flat);
+    }
+
+    void write_strings(std::vector<std::string> const& values)
+    {
+        std::vector<std::uint64_t> offsets = {0};
+        std::vector<char> flat;
+        for(auto &value : values){
+            flat.insert(flat.end(), value.begin(), value.end());
+            offsets.push_back(flat.size());
+        }
+        write_array(offsets);
+        write_array(flat);
+    }
+};
+
+struct SnapshotReader
 {
-    // Replace the line below with your implementation
-    // Also uncomment parameters ( /* param */ -> param )
-    throw NotImplemented("route_earliest_arrival()");
+    char const* position;
+    char const* end;
+    bool ok = true;
+
+    template <typename Type>
+    Type read_value()
+    {
+        Type value{};
+        if(ok && static_cast<std::size_t>(end - position) >= sizeof(Type)){
+            std::memcpy(&value, position, sizeof(Type));
+            position += sizeof(Type);
+        } else {
+            ok = false;
+        }
+        return value;
+    }
+
+    template <typename Type>
+    std::vector<Type> read_array()
+    {
+        std::vector<Type> values;
+        auto count = read_value<std::uint64_t>();
+        if(!ok || count > static_cast<std::size_t>(end - position) / sizeof(Type)){
+            ok = false;
+            return values;
+        }
+        if(count == 0){
+            return values;
+        }
+        values.resize(count);
+        // Elements are plain integers, Coords or pairs of integers, so raw bytes are enough
+        std::memcpy(static_cast<void*>(values.data()), position, count * sizeof(Type));
+        position += count * sizeof(Type);
+        return values;
+    }
+
+    template <typename Type>
+    std::vector<std::vector<Type>> read_nested()
+    {
+        auto offsets = read_array<std::uint64_t>();
+        auto flat = read_array<Type>();
+        std::vector<std::vector<Type>> values;
+        if(!valid_offsets(offsets, flat.size())){
+            return values;
+        }
+        values.reserve(offsets.size() - 1);
+        for(std::size_t i = 0; i + 1 < offsets.size(); i++){
+            values.emplace_back(flat.begin() + offsets[i], flat.begin() + offsets[i+1]);
+        }
+        return values;
+    }
+
+    std::vector<std::string> read_strings()
+    {
+        auto offsets = read_array<std::uint64_t>();
+        auto flat = read_array<char>();
+        std::vector<std::string> values;
+        if(!valid_offsets(offsets, flat.size())){
+            return values;
+        }
+        values.reserve(offsets.size() - 1);
+        for(std::size_t i = 0; i + 1 < offsets.size(); i++){
+            values.emplace_back(flat.data() + offsets[i], offsets[i+1] - offsets[i]);
+        }
+        return values;
+    }
+
+    bool valid_offsets(std::vector<std::uint64_t> const& offsets, std::size_t size)
+    {
+        if(!ok || offsets.empty() || offsets.front() != 0 || offsets.back() != size
+                || !std::is_sorted(offsets.begin(), offsets.end())){
+            ok = false;
+        }
+        return ok;
+    }
+};
+
+/**
+ * @brief Datastructures::save_snapshot, write the whole datastructure into a binary file
+ * @param filename, file to write
+ * @return true if writing was successful, false if not
+ */
+bool Datastructures::save_snapshot(std::string const& filename){
+    WriteLock lock(*this);
+    // Removed stations are not stored
+    compact_stations();
+
+    SnapshotWriter writer;
+    writer.file.open(filename, std::ios::binary | std::ios::trunc);
+    if(!writer.file){
+        return false;
+    }
+    writer.file.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writer.write_value(SNAPSHOT_VERSION);
+    // Byte order and type sizes have to match when the snapshot is loaded
+    writer.write_value<std::uint32_t>(0x01020304);
+    writer.write_value<std::uint32_t>(sizeof(Time));
+
+    writer.write_strings(station_IDs);
+    writer.write_strings(station_names);
+    writer.write_array(station_coords);
+    writer.write_array(station_region);
+    // Train links are not stored, load_snapshot makes them from train_stops
+    writer.write_nested(station_departures);
+
+    writer.write_strings(train_IDs);
+    writer.write_array(std::vector<char>(train_added.begin(), train_added.end()));
+    writer.write_nested(train_stops);
+
+    writer.write_array(region_IDs);
+    writer.write_strings(region_names);
+    writer.write_nested(region_coords);
+    writer.write_array(region_parent);
+    writer.write_nested(region_subregions);
+    writer.write_nested(region_stations);
+
+    writer.file.flush();
+    return static_cast<bool>(writer.file);
+}
+
+/**
+ * @brief Datastructures::snapshot_consistent, check that the arrays read by load_snapshot only
+ * refer to existing stations, trains and regions, that departures are in order and that the
+ * regions form a forest
+ * @return true if the arrays can be indexed safely, false if not
+ */
+bool Datastructures::snapshot_consistent() const{
+    std::size_t stations = station_IDs.size();
+    std::size_t trains = train_IDs.size();
+    std::size_t regions = region_IDs.size();
+
+    for(StationIdx i = 0; i < stations; i++){
+        if(station_region[i] != NO_INDEX && station_region[i] >= regions){
+            return false;
+        }
+        for(auto &departure : station_departures[i]){
+            if(departure.second >= trains){
+                return false;
+            }
+        }
+    }
+    // Departures are searched with binary search, so they have to be in order
+    auto before = [this](std::pair<Time, TrainIdx> const& first, std::pair<Time, TrainIdx> const& second){
+        return departure_before(first, second);
+    };
+    for(StationIdx i = 0; i < stations; i++){
+        if(!std::is_sorted(station_departures[i].begin(), station_departures[i].end(), before)){
+            return false;
+        }
+    }
+    for(TrainIdx i = 0; i < trains; i++){
+        // Only trains added with add_train have stops
+        if(!train_added[i] && !train_stops[i].empty()){
+            return false;
+        }
+        for(auto &stop : train_stops[i]){
+            if(stop.first >= stations){
+                return false;
+            }
+        }
+    }
+
+    // Every region with a parent is listed exactly once among the subregions of that parent,
+    // every station with a region once among the stations of that region
+    std::vector<bool> listed(regions, false);
+    std::vector<bool> station_listed(stations, false);
+    std::size_t children = 0;
+    for(RegionIdx i = 0; i < regions; i++){
+        if(region_parent[i] != NO_INDEX){
+            if(region_parent[i] >= regions){
+                return false;
+            }
+            children++;
+        }
+        for(auto child : region_subregions[i]){
+            if(child >= regions || region_parent[child] != i || listed[child]){
+                return false;
+            }
+            listed[child] = true;
+        }
+        for(auto station : region_stations[i]){
+            if(station >= stations || station_region[station] != i || station_listed[station]){
+                return false;
+            }
+            station_listed[station] = true;
+        }
+    }
+    if(std::count(listed.begin(), listed.end(), true) != static_cast<std::ptrdiff_t>(children)){
+        return false;
+    }
+    for(StationIdx i = 0; i < stations; i++){
+        if(station_region[i] != NO_INDEX && !station_listed[i]){
+            return false;
+        }
+    }
+    // Follow the parents of every region, a chain that comes back to itself is a cycle.
+    // 0 = not visited, 1 = on the current chain, 2 = known to end at a root
+    std::vector<unsigned char> state(regions, 0);
+    std::vector<RegionIdx> chain;
+    for(RegionIdx i = 0; i < regions; i++){
+        RegionIdx region = i;
+        while(region != NO_INDEX && state[region] == 0){
+            state[region] = 1;
+            chain.push_back(region);
+            region = region_parent[region];
+        }
+        if(region != NO_INDEX && state[region] == 1){
+            return false;
+        }
+        for(auto member : chain){
+            state[member] = 2;
+        }
+        chain.clear();
+    }
+    return true;
+}
+
+/**
+ * @brief Datastructures::load_snapshot, replace the whole datastructure with a snapshot from save_snapshot
+ * @param filename, file to read
+ * @return true if loading was successful, false if not (the datastructure is left empty
+ * if the file was opened but turned out to be broken)
+ */
+bool Datastructures::load_snapshot(std::string const& filename){
+    WriteLock lock(*this);
+    // The whole file is read with one call, the arrays are then copied out of the buffer
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if(!file){
+        return false;
+    }
+    std::streamoff end = file.tellg();
+    if(end <= 0){
+        return false;
+    }
+    std::size_t size = end;
+    std::vector<char> buffer(size);
+    file.seekg(0);
+    if(!file.read(buffer.data(), size)){
+        return false;
+    }
+    char const* data = buffer.data();
+
+    SnapshotReader reader{data, data + size};
+    bool ok = size >= sizeof(SNAPSHOT_MAGIC) && std::memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+    reader.position += sizeof(SNAPSHOT_MAGIC);
+    ok = ok && reader.read_value<std::uint32_t>() == SNAPSHOT_VERSION
+            && reader.read_value<std::uint32_t>() == 0x01020304
+            && reader.read_value<std::uint32_t>() == sizeof(Time);
+
+    if(ok){
+        clear_all();
+        station_IDs = reader.read_strings();
+        station_names = reader.read_strings();
+        station_coords = reader.read_array<Coord>();
+        station_region = reader.read_array<RegionIdx>();
+        station_departures = reader.read_nested<std::pair<Time, TrainIdx>>();
+
+        train_IDs = reader.read_strings();
+        auto added = reader.read_array<char>();
+        train_added.assign(added.begin(), added.end());
+        train_stops = reader.read_nested<std::pair<StationIdx, Time>>();
+
+        region_IDs = reader.read_array<RegionID>();
+        region_names = reader.read_strings();
+        region_coords = reader.read_nested<Coord>();
+        region_parent = reader.read_array<RegionIdx>();
+        region_subregions = reader.read_nested<RegionIdx>();
+        region_stations = reader.read_nested<StationIdx>();
+
+        std::size_t stations = station_IDs.size();
+        std::size_t trains = train_IDs.size();
+        std::size_t regions = region_IDs.size();
+        ok = reader.ok && station_names.size() == stations && station_coords.size() == stations
+                && station_region.size() == stations && station_departures.size() == stations
+                && train_added.size() == trains
+                && train_stops.size() == trains && region_names.size() == regions
+                && region_coords.size() == regions && region_parent.size() == regions
+                && region_subregions.size() == regions && region_stations.size() == regions
+                && snapshot_consistent();
+        // IDs have to be unique, a second one is found when the lookup tables are filled
+        if(ok){
+            station_index.reserve(stations);
+            for(StationIdx i = 0; i < stations && ok; i++){
+                ok = station_index.emplace(station_IDs[i], i).second;
+            }
+            train_index.reserve(trains);
+            for(TrainIdx i = 0; i < trains && ok; i++){
+                ok = train_index.emplace(train_IDs[i], i).second;
+            }
+            region_index.reserve(regions);
+            for(RegionIdx i = 0; i < regions && ok; i++){
+                ok = region_index.emplace(region_IDs[i], i).second;
+            }
+        }
+        if(ok){
+            // Rebuild the indexes that are not stored in the snapshot. Train links come from
+            // train_stops, rows are sized first so that each is allocated once.
+            station_removed.assign(stations, false);
+            station_region_position.assign(stations, NO_INDEX);
+            for(RegionIdx i = 0; i < regions; i++){
+                for(unsigned int j = 0; j < region_stations[i].size(); j++){
+                    station_region_position[region_stations[i][j]] = j;
+                }
+            }
+            std::vector<unsigned int> next_count(stations, 0);
+            std::vector<unsigned int> previous_count(stations, 0);
+            std::size_t stops_total = 0;
+            for(auto &stops : train_stops){
+                for(std::size_t j = 0; j + 1 < stops.size(); j++){
+                    next_count[stops[j].first]++;
+                    previous_count[stops[j+1].first]++;
+                }
+                stops_total += stops.size();
+            }
+            station_next.resize(stations);
+            station_previous.resize(stations);
+            for(StationIdx i = 0; i < stations; i++){
+                station_next[i].reserve(next_count[i]);
+                station_previous[i].reserve(previous_count[i]);
+            }
+            for(TrainIdx i = 0; i < trains; i++){
+                auto &stops = train_stops[i];
+                for(std::size_t j = 0; j + 1 < stops.size(); j++){
+                    station_next[stops[j].first].push_back({i, stops[j+1].first});
+                    station_previous[stops[j+1].first].push_back({i, stops[j].first});
+                }
+            }
+            alphabetical_order.reserve(stations);
+            coordinates.reserve(stations);
+            for(StationIdx i = 0; i < stations; i++){
+                alphabetical_order.push_back(i);
+                coordinates.push_back(i);
+                grid_insert(i);
+            }
+            alphabetical_dirty = true;
+            coordinates_dirty = true;
+            connection_tail.assign(trains, NO_INDEX);
+            stop_index.reserve(stops_total);
+            for(TrainIdx i = 0; i < trains; i++){
+                index_stops(i);
+            }
+            connections_stale = true;
+            connections_dirty = true;
+            links_changed();
+            region_depth.assign(regions, 0);
+            for(RegionIdx i = 0; i < regions; i++){
+                region_bounds.push_back(bounding_box(region_coords[i]));
+            }
+            region_tree_dirty = true;
+            for(RegionIdx i = 0; i < regions; i++){
+                if(region_parent[i] == NO_INDEX){
+                    update_region_ancestry(i);
+                }
+            }
+            euler_dirty = true;
+        } else {
+            clear_all();
+        }
+    }
+
+    return ok;
 }
@@ -7,10 +7,18 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <list>
 #include <tuple>
 #include <utility>
 #include <limits>
 #include <functional>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
 #include <exception>
 
 
@@ -74,6 +82,43 @@ using Distance = int;
 // Return value for cases where Distance is unknown
 Distance const NO_DISTANCE = NO_VALUE;
 
+// Type for one train ride of a journey: boarding station, train, departure time,
+// alighting station and arrival time
+using JourneyLeg = std::tuple<StationID, TrainID, Time, StationID, Time>;
+
+// Type for the stations a budgeted search reaches, as parallel arrays in the order they were
+// reached. costs[i] is the distance or travel time to stations[i] and previous[i] the position
+// of the station before it on the way there, NO_VALUE for the start.
+struct Reachable
+{
+    std::vector<StationID> stations;
+    std::vector<int> costs;
+    std::vector<int> previous;
+};
+
+// Type for the counters of the route cache. A stale entry is one dropped because the network
+// changed after it was stored, an eviction one dropped to make room.
+struct RouteCacheStats
+{
+    std::size_t hits = 0;
+    std::size_t misses = 0;
+    std::size_t stale = 0;
+    std::size_t evictions = 0;
+    std::size_t entries = 0;
+    std::size_t capacity = 0;
+};
+
+// Type for a table of routes from every source to every target, stored row by row
+// (entry source * targets + target). Hops is the number of links on the route through the
+// fewest stations and distances its length, NO_VALUE and NO_DISTANCE if there is no route.
+struct RouteMatrix
+{
+    std::size_t sources = 0;
+    std::size_t targets = 0;
+    std::vector<int> hops;
+    std::vector<Distance> distances;
+};
+
 // This exception class is there just so that the user interface can notify
 // about operations which are not (yet) implemented
 class NotImplemented : public std::exception
@@ -105,61 +150,69 @@ public:
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: size() depends on the size of the datastructure
-    unsigned int station_count();
+    unsigned int station_count() const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: Clearing vector or unordered_map is a linear operation, worst case linear
     void clear_all();
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: Returning a variable is a linear operation
-    std::vector<StationID> all_stations();
+    // Short rationale for estimate: Returning a variable is a linear operation, removed stations are skipped
+    std::vector<StationID> all_stations() const;
 
     // Estimate of performance: O(1)
-    // Short rationale for estimate: On average, inserting into a unordered_map is constant operation
+    // Short rationale for estimate: On average, inserting into a unordered_map is constant operation.
+    // The views built from train links get an empty row for the station instead of a rebuild.
     bool add_station(StationID id, Name const& name, Coord xy);
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: on average, find() is constant time operation
-    Name get_station_name(StationID id);
+    Name get_station_name(StationID id) const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: on average, find() is constant time operation
-    Coord get_station_coordinates(StationID id);
+    Coord get_station_coordinates(StationID id) const;
 
     // We recommend you implement the operations below only after implementing the ones above
 
-    // Estimate of performance: O(n*log(n))
-    // Short rationale for estimate: std::sort() is, on average, linearithmic operation
-    std::vector<StationID> stations_alphabetically();
-
-    // Estimate of performance: O(n^2)
-    // Short rationale for estimate: std::sort() is, on average, linearithmic operation,
-    // std::is_sorted() is linear operation
-    std::vector<StationID> stations_distance_increasing();
-
     // Estimate of performance: O(n)
-    // Short rationale for estimate: worst case the whole unordered_map has to be looped through
-    StationID find_station_with_coord(Coord xy);
+    // Short rationale for estimate: only stations added after the previous call are sorted
+    // (k*log(k)) and merged into the sorted part (linear), then the cached list is copied
+    std::vector<StationID> stations_alphabetically() const;
 
     // Estimate of performance: O(n)
-    // Short rationale for estimate: on average, find() is constant time operation, worst case linear
+    // Short rationale for estimate: only stations added or moved after the previous call are sorted
+    // (k*log(k)) and merged into the sorted part (linear), then the cached list is copied
+    std::vector<StationID> stations_distance_increasing() const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: on average, finding the grid cell is constant time operation
+    // and a cell holds only a few stations
+    StationID find_station_with_coord(Coord xy) const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: on average, find() is constant time operation and moving
+    // the station between two grid cells only touches those cells. The distance view only gets
+    // a new entry for the station, the old one is dropped when the view is merged. Link
+    // lengths and the views built from them are only rebuilt if trains stop at the station.
     bool change_station_coord(StationID id, Coord newcoord);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: on average, find() is constant time operation (worst case linear)
-    // and adding into a vector is constant time operation
+    // Estimate of performance: O(k), k = departures of the station
+    // Short rationale for estimate: on average, find() is constant time operation and the place is found
+    // with binary search in O(log(k)), inserting shifts the later departures with one memmove. A
+    // balanced tree would make this O(log(k)) but lose the contiguous copy in station_departures_after,
+    // and the shift of a few thousand small pairs is cheaper than a tree insert in practice.
     bool add_departure(StationID stationid, TrainID trainid, Time time);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: on average, find() is constant time operation, but worst case the whole datastructure
-    // has to be looped through which is a linear operation
+    // Estimate of performance: O(k), k = departures of the station
+    // Short rationale for estimate: on average, find() is constant time operation and the departure is found
+    // with binary search in O(log(k)), erasing shifts the later departures with one memmove
     bool remove_departure(StationID stationid, TrainID trainid, Time time);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: on average, find() is constant time operation, worst case linear,
-    // and adding into a vector is constant time operation
-    std::vector<std::pair<Time, TrainID>> station_departures_after(StationID stationid, Time time);
+    // Estimate of performance: O(log(k) + m), m = returned departures
+    // Short rationale for estimate: departures are kept sorted, binary search finds the first one
+    // and the rest are copied as they are
+    std::vector<std::pair<Time, TrainID>> station_departures_after(StationID stationid, Time time) const;
 
     // We recommend you implement the operations below only after implementing the ones above
 
@@ -170,19 +223,19 @@ public:
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: Returning a variable is a constant time operation
-    std::vector<RegionID> all_regions();
+    std::vector<RegionID> all_regions() const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: on average, find() is constant time operation
-    Name get_region_name(RegionID id);
+    Name get_region_name(RegionID id) const;
 
     // Estimate of performance: O(1)
     // Short rationale for estimate: on average, find() is constant time operation
-    std::vector<Coord> get_region_coords(RegionID id);
+    std::vector<Coord> get_region_coords(RegionID id) const;
 
-    // Estimate of performance: O(1)
-    // Short rationale for estimate: on average, find() is constant time operation and adding into
-    // a vector is constant time operation
+    // Estimate of performance: O(s*log(n)), s = regions in the subtree of id
+    // Short rationale for estimate: on average, find() is constant time operation, ancestor tables are
+    // updated only for the attached subtree (a single region when the tree is built top down)
     bool add_subregion_to_region(RegionID id, RegionID parentid);
 
     // Estimate of performance: O(1)
@@ -193,25 +246,41 @@ public:
     // Estimate of performance: O(n)
     // Short rationale for estimate: on average, find() is constant time operation (worst case linear)
     // and adding into a vector is constant time operation
-    std::vector<RegionID> station_in_regions(StationID id);
-
-    // Non-compulsory operations
+    std::vector<RegionID> station_in_regions(StationID id) const;
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<RegionID> all_subregions_of_region(RegionID id);
+    // Estimate of performance: O(log(n) + c*p), c = candidate regions, p = polygon size
+    // Short rationale for estimate: packed R-tree of region bounding boxes gives the candidates,
+    // the deepest region whose polygon contains xy is walked up like in station_in_regions
+    // (the tree is rebuilt in O(n*log(n)) on the first query after regions were added)
+    std::vector<RegionID> regions_containing(Coord xy) const;
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<StationID> stations_closest_to(Coord xy);
+    // Non-compulsory operations
 
-    // Estimate of performance:
-    // Short rationale for estimate:
+    // Estimate of performance: O(k), k = number of subregions
+    // Short rationale for estimate: subregions are a contiguous range of the Euler tour
+    // (the tour is rebuilt in O(n) on the first query after the tree has changed)
+    std::vector<RegionID> all_subregions_of_region(RegionID id) const;
+
+    // Estimate of performance: O(log(n) + p), p = stations added or moved since the last rebuild
+    // Short rationale for estimate: a k-d tree search only descends into subtrees that can
+    // still hold a closer station, new and moved stations are checked one by one until the
+    // next query rebuilds the tree in O(n log(n)) (at most once per n/16 changes)
+    std::vector<StationID> stations_closest_to(Coord xy) const;
+
+    // Estimate of performance: O(d + log(n)), d = stops of the trains through the station
+    // Short rationale for estimate: the station is only marked removed, trains through it are
+    // relinked and their rows in the search graph patched, its grid cell is updated and the last
+    // station of its region takes its place there, compaction is amortized constant
     bool remove_station(StationID id);
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: worst case regions struct must be looped through
-    RegionID common_parent_of_regions(RegionID id1, RegionID id2);
+    // Estimate of performance: O(log(n))
+    // Short rationale for estimate: lowest common ancestor with binary lifting
+    RegionID common_parent_of_regions(RegionID id1, RegionID id2) const;
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: on average, find() is constant time operation and Euler tour
+    // intervals are compared (the tour is rebuilt in O(n) on the first query after the tree has changed)
+    bool is_subregion_of(RegionID id, RegionID parentid) const;
 
     //
     // New assignment 2 operations
@@ -223,72 +292,549 @@ public:
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: on average, find() is constant time operation
-    std::vector<StationID> next_stations_from(StationID id);
+    std::vector<StationID> next_stations_from(StationID id) const;
 
-    // Estimate of performance: O(n)
-    // Short rationale for estimate: on average, find() is constant time operation
-    std::vector<StationID> train_stations_from(StationID stationid, TrainID trainid);
+    // Estimate of performance: O(k), k = stops of the train after the station
+    // Short rationale for estimate: one hash lookup finds the stop on the train's route, the
+    // stops after it are copied from there
+    std::vector<StationID> train_stations_from(StationID stationid, TrainID trainid) const;
 
     // Estimate of performance: O(n)
     // Short rationale for estimate: clear() is linear time operation
     void clear_trains();
 
+    // Estimate of performance: O(k*d), k = stops of the train, d = departures and links per stop
+    // Short rationale for estimate: the train's departures and links are taken out of the stations it
+    // stops at, also from their rows in the search graph, and its connections are marked retired.
+    // Removing links never makes a route shorter, so components and landmark estimates stay valid.
+    // The distance hierarchy may have shortcuts over the removed links, so the next
+    // route_shortest_distance rebuilds it.
+    bool remove_train(TrainID trainid);
+
+    // Estimate of performance: O(k*(d + log(c))), c = connections
+    // Short rationale for estimate: the train's departures are moved in the stations it stops at and
+    // its connections retired and added again, train links stay as they are. times has one time per stop.
+    bool update_train_times(TrainID trainid, std::vector<Time> times);
+
+    // Estimate of performance: O(k*(d + log(c)))
+    // Short rationale for estimate: update_train_times with delay added to the stops from the
+    // train's first stop at the station onwards
+    bool delay_train(TrainID trainid, StationID stationid, Time delay);
+
     // Estimate of performance: O(n)
-    // Short rationale for estimate: BFS is on average linear time operation
-    std::vector<std::pair<StationID, Distance>> route_any(StationID fromid, StationID toid);
+    // Short rationale for estimate: BFS is on average linear time operation, search state is reused
+    // between queries so nothing is allocated except the result
+    std::vector<std::pair<StationID, Distance>> route_any(StationID fromid, StationID toid) const;
 
     // Non-compulsory operations
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<std::pair<StationID, Distance>> route_least_stations(StationID fromid, StationID toid);
+    // Estimate of performance: O(n + e), in practice about the square root of one sided BFS
+    // Short rationale for estimate: BFS from both ends over forward and backward links, always
+    // growing the smaller frontier by a whole level until the two meet
+    std::vector<std::pair<StationID, Distance>> route_least_stations(StationID fromid, StationID toid) const;
+
+    // Estimate of performance: O(n + e), O(1) when no cycle can be reached
+    // Short rationale for estimate: iterative DFS that stops at the first link back to a station
+    // on its path and never enters a component from which no cycle can be reached
+    std::vector<StationID> route_with_cycle(StationID fromid) const;
+
+    // Estimate of performance: O((n + e)*log(n))
+    // Short rationale for estimate: Dijkstra with an indexed 4-ary heap, search state is reused
+    // between queries so nothing is allocated except the result
+    std::vector<std::pair<StationID, Distance>> route_shortest_distance(StationID fromid, StationID toid) const;
+
+    // Estimate of performance: O(log(c) + c), c connections departing after starttime
+    // Short rationale for estimate: Connection scan over hops sorted by departure time, one
+    // linear pass that stops as soon as no connection can arrive earlier
+    std::vector<std::pair<StationID, Time>> route_earliest_arrival(StationID fromid, StationID toid, Time starttime) const;
+
+    //
+    // Bulk loading operations, same rules as the single add_* operations but
+    // containers are sized once and the heavy parts are spread over all cores
+    //
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: containers are reserved up front, then every station goes into
+    // the ID table, the arrays and its grid cell in one pass (duplicates and already existing IDs
+    // are skipped). Lazy indexes are marked out of date once for the batch.
+    unsigned int add_stations_bulk(std::vector<std::tuple<StationID, Name, Coord>> const& stations);
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: containers are reserved up front, then every region goes into
+    // the ID table and the arrays in one pass (duplicates and already existing IDs are skipped).
+    // The ancestor table grows and lazy indexes are marked out of date once for the batch.
+    unsigned int add_regions_bulk(std::vector<std::tuple<RegionID, Name, std::vector<Coord>>> const& regions);
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: every pair is two constant time finds and a push_back
+    unsigned int add_stations_to_regions_bulk(std::vector<std::pair<StationID, RegionID>> const& pairs);
+
+    // Estimate of performance: O(n/p + s*log(s)), n = all stops of all trains, p = cores
+    // Short rationale for estimate: station IDs are resolved in parallel, links are appended in one
+    // pass and only the departures of touched stations are sorted (in parallel), the search
+    // indexes are marked out of date once for the batch
+    unsigned int add_trains_bulk(std::vector<std::pair<TrainID, std::vector<std::pair<StationID, Time>>>> const& trains);
+
+    // Estimate of performance: O(n + m), m = stops of all trains
+    // Short rationale for estimate: every index referring to stations is renumbered once
+    void compact_stations();
+
+    //
+    // Snapshot operations
+    //
+
+    // Estimate of performance: O(n)
+    // Short rationale for estimate: every array is written once as a single block
+    bool save_snapshot(std::string const& filename);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<StationID> route_with_cycle(StationID fromid);
+    // Estimate of performance: O(n + m), m = stops of all trains
+    // Short rationale for estimate: the file is read with one call and every array is copied
+    // out of it with one memcpy. The ID lookup tables, the spatial grid, the train links and
+    // the stop index are rebuilt, one hash insert per ID and per stop, which is most of the time.
+    bool load_snapshot(std::string const& filename);
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<std::pair<StationID, Distance>> route_shortest_distance(StationID fromid, StationID toid);
+    //
+    // Journey planning operations
+    //
 
-    // Estimate of performance:
-    // Short rationale for estimate:
-    std::vector<std::pair<StationID, Time>> route_earliest_arrival(StationID fromid, StationID toid, Time starttime);
+    // Estimate of performance: O(k*(d + m)), k = max_trains, d = departures and m = stops
+    // scanned per round
+    // Short rationale for estimate: round based search, round k finds the earliest arrivals with
+    // at most k trains and only rescans trains leaving stations improved in the previous round.
+    // Nothing departing after the best arrival at the destination so far is looked at.
+    std::vector<std::vector<JourneyLeg>> journeys_pareto(StationID fromid, StationID toid, Time starttime,
+                                                         unsigned int max_trains = 5) const;
+
+    // Estimate of performance: O(c*log(p)), c = connections departing at starttime or later,
+    // p = journeys kept per station
+    // Short rationale for estimate: profile connection scan, one pass from the latest connection
+    // backwards keeps for every station the journeys to the destination no later departure beats,
+    // so every departure time of the window shares the same scan
+    std::vector<std::pair<Time, Time>> journeys_profile(StationID fromid, StationID toid, Time starttime, Time endtime) const;
+
+    //
+    // Batch operations
+    //
+
+    // Estimate of performance: O(s*(n + e)/p + s*t*h), s sources, t targets, p cores, h hops per route
+    // Short rationale for estimate: one BFS per source that stops once every target is found,
+    // sources are handed out to one worker per core and each keeps only its own search state.
+    // progress(done, total) is called after every finished source, one call at a time. It may
+    // query the datastructure but not modify it, a modifying call throws std::logic_error.
+    RouteMatrix route_matrix(std::vector<StationID> const& sources, std::vector<StationID> const& targets,
+                             std::function<void(std::size_t, std::size_t)> const& progress = {}) const;
+
+    //
+    // Reachability operations, results go to a Reachable that can be reused between calls so
+    // that its arrays keep their capacity. Return false if the station doesn't exist.
+    //
+
+    // Estimate of performance: O((k + e_k)*log(k)), k = stations within the budget, e_k their links
+    // Short rationale for estimate: Dijkstra that never queues a station further than budget,
+    // search state is reused between queries
+    bool stations_within_distance(StationID fromid, Distance budget, Reachable& result) const;
+
+    // Estimate of performance: O(log(c) + c_b + k*log(k)), c_b = connections departing within the budget
+    // Short rationale for estimate: connection scan from starttime that stops at the first connection
+    // leaving after starttime + budget, the k reached stations are then sorted by arrival
+    bool stations_within_time(StationID fromid, Time starttime, Time budget, Reachable& result) const;
+
+    //
+    // Preprocessing operations
+    //
+
+    // Estimate of performance: O(n*(w + d*d)*log(n)), w = WITNESS_LIMIT, d = links per station
+    // Short rationale for estimate: stations are contracted in order of how few shortcuts they
+    // need, every contraction runs bounded witness searches between its neighbours. Afterwards
+    // route_shortest_distance only searches upwards from both ends, and the hierarchy is
+    // rebuilt by the first such query after the train network changes.
+    void build_distance_hierarchy();
+
+    // Estimate of performance: O(k*(n + e)*log(n)), k = count
+    // Short rationale for estimate: landmarks are picked one at a time as the station furthest
+    // from the earlier ones, a Dijkstra both ways from each. Recomputed by the first distance
+    // query after the train network changes, 0 switches landmarks off.
+    void build_landmarks(unsigned int count);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: sets a flag, off makes route_shortest_distance plain Dijkstra
+    void set_goal_directed(bool enabled);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: the searches count settled stations as they go
+    unsigned int last_route_settled() const;
+
+    //
+    // Route cache
+    //
+
+    // Estimate of performance: O(k), k = entries dropped when shrinking
+    // Short rationale for estimate: keeps at most capacity results of route_any, route_least_stations,
+    // route_shortest_distance and route_earliest_arrival, least recently used ones go first. 0 turns
+    // the cache off. Results are dropped when the trains, coordinates or departures they used change.
+    void set_route_cache_capacity(std::size_t capacity);
+
+    // Estimate of performance: O(1)
+    // Short rationale for estimate: counters are kept up to date by the queries
+    RouteCacheStats route_cache_stats() const;
 
 private:
-    // Struct for information about railway stations
-    struct Region;
-    struct Stop{
-        Name name;
-        StationID SID;
-        Region* RID = nullptr;
-        Coord coords;
-        Time time = NO_TIME;
-        TrainID TID = NO_TRAIN;
-        std::vector<std::pair<Time,TrainID>> departures = {};
-        std::unordered_map<TrainID, Stop*> neighbours = {};
-        Stop* previous = nullptr;
+    // Dense indexes, IDs are translated into these once at the start of every operation
+    using StationIdx = std::uint32_t;
+    using TrainIdx = std::uint32_t;
+    using RegionIdx = std::uint32_t;
+    static constexpr std::uint32_t NO_INDEX = std::numeric_limits<std::uint32_t>::max();
+
+    StationIdx find_station(StationID const& id) const;
+    RegionIdx find_region(RegionID id) const;
+
+    // Queries share rw_lock and modifying operations hold it alone. Lazily rebuilt
+    // indexes are rebuilt by the first reader that needs them, under lazy_mutex, which is
+    // why they are mutable and every query can be const.
+    mutable std::shared_mutex rw_lock;
+    mutable std::mutex lazy_mutex;
+    // std::shared_mutex lets new readers in while a writer waits, so a steady stream of
+    // queries could keep writers out for good. New readers wait at this gate instead
+    // while writers_waiting is nonzero.
+    mutable std::atomic<unsigned int> writers_waiting{0};
+    mutable std::mutex gate_mutex;
+    mutable std::condition_variable gate_open;
+    // Guards are re-entrant per thread. A WriteLock taken while the same thread reads
+    // (for example from the route_matrix progress callback) throws std::logic_error.
+    class ReadLock{
+    public:
+        explicit ReadLock(Datastructures const& ds, bool adopt = false);
+        ~ReadLock();
+    private:
+        Datastructures const& ds_;
+        Datastructures const* previous_;
+        bool previous_alone_;
+        bool owned_;
+        bool adopted_;
+    };
+    class WriteLock{
+    public:
+        explicit WriteLock(Datastructures const& ds);
+        ~WriteLock();
+    private:
+        Datastructures const& ds_;
+        Datastructures const* previous_;
+        bool previous_alone_;
+        bool owned_;
     };
-    // Different vectors to store all SIDs
+    TrainIdx intern_train(TrainID const& id);
+
+    // Information about railway stations, stored as struct of arrays indexed by StationIdx
+    std::unordered_map<StationID, StationIdx> station_index;
     std::vector<StationID> station_IDs;
-    std::unordered_map<StationID, Stop> stations;
-    std::vector<Stop*> alphabetical_order;
-    std::vector<Stop*> coordinates;
-
-    std::unordered_map<TrainID, std::vector<std::pair<StationID, Time>>> trains;
-
-    // Struct for information about region
-    struct Region{
-        Name name;
-        RegionID RID;
-        std::vector<Coord> coords;
-        Region* parentreg = nullptr;
-        std::vector<RegionID> subregions = {};
-        std::vector<Stop*> stations = {};
+    std::vector<Name> station_names;
+    std::vector<Coord> station_coords;
+    std::vector<RegionIdx> station_region;
+    // Position of the station in region_stations of its region, NO_INDEX if it has none
+    std::vector<unsigned int> station_region_position;
+    // Departures of the station ordered by time and train ID
+    std::vector<std::vector<std::pair<Time, TrainIdx>>> station_departures;
+    bool departure_before(std::pair<Time, TrainIdx> const& first, std::pair<Time, TrainIdx> const& second) const;
+    std::vector<std::pair<Time, TrainIdx>>::iterator departure_position(StationIdx station, Time time, TrainIdx train);
+    bool erase_departure(StationIdx station, Time time, TrainIdx train);
+    // Trains leaving from the station and the station they go to next
+    std::vector<std::vector<std::pair<TrainIdx, StationIdx>>> station_next;
+    // The same links backwards: trains arriving at the station and the station they came from
+    std::vector<std::vector<std::pair<TrainIdx, StationIdx>>> station_previous;
+    // Removed stations keep their slot until compact_stations(), every index skips them
+    std::vector<bool> station_removed;
+    std::size_t removed_count = 0;
+    void unlink_train(TrainIdx train);
+    void relink_train(TrainIdx train, std::vector<std::pair<StationIdx, Time>> stops);
+
+    // Train links frozen into compressed sparse rows for the searches: the links of station i
+    // are [first[i], end[i]) in the other arrays and length is their distance() worked out
+    // in advance. forward_links follows station_next and backward_links station_previous.
+    // build leaves no gaps between rows, erase_train shortens a row in place and leaves
+    // unused slots before the next one.
+    struct LinkGraph{
+        std::vector<unsigned int> first;
+        std::vector<unsigned int> end;
+        std::vector<StationIdx> to;
+        std::vector<Distance> length;
+        std::vector<TrainIdx> train;
+
+        void build(std::vector<std::vector<std::pair<TrainIdx, StationIdx>>> const& links,
+                   std::vector<Coord> const& coords);
+        void erase_train(StationIdx station, TrainIdx link_train);
+        void add_row();
+        void replace_train(StationIdx station, TrainIdx link_train,
+                           std::vector<std::pair<TrainIdx, StationIdx>> const& links,
+                           std::vector<Coord> const& coords);
+    };
+    mutable LinkGraph forward_links;
+    mutable LinkGraph backward_links;
+    mutable std::atomic<bool> links_dirty{false};
+    void update_links() const;
+
+    // Search state of routing queries, kept between queries so that they don't allocate.
+    // A station's slot is valid only when its stamp equals the current generation, so
+    // starting a new search doesn't have to clear anything.
+    struct SearchScratch{
+        std::vector<unsigned int> stamp;
+        std::vector<Distance> dist;
+        std::vector<StationIdx> parent;
+        // Heap order, dist plus the estimate of the remaining distance in goal directed searches
+        std::vector<Distance> key;
+        // Position of a station in heap, SETTLED once it has been popped
+        std::vector<unsigned int> heap_pos;
+        std::vector<StationIdx> heap;
+        std::vector<StationIdx> queue;
+        // Connection scan: connection that reached a station, stamps of boarded trains and
+        // the stop a boarded train is at, as a hop dropped from connections gets it off there
+        std::vector<unsigned int> via;
+        std::vector<unsigned int> boarded;
+        std::vector<unsigned int> riding_stop;
+        bool riding(TrainIdx train, unsigned int stop) const;
+        void ride(TrainIdx train, unsigned int stop);
+        // Journey planner: slot of a train in the current round's queue, NO_INDEX if not queued
+        std::vector<unsigned int> train_slot;
+        // Depth first search: stations on the path and the position of their next link to follow
+        std::vector<std::pair<StationIdx, unsigned int>> stack;
+        unsigned int generation = 0;
+        // Stations popped from the heap since start
+        unsigned int settled = 0;
+        static constexpr unsigned int SETTLED = std::numeric_limits<unsigned int>::max();
+
+        void start(std::size_t stations, std::size_t trains = 0);
+        bool reached(StationIdx station) const;
+        void reach(StationIdx station, Distance distance, StationIdx from, Distance estimate = 0);
+        void heap_push(StationIdx station);
+        void heap_decrease(StationIdx station);
+        StationIdx heap_pop();
+        void sift_up(unsigned int position);
+        void sift_down(unsigned int position);
+    };
+    static thread_local SearchScratch scratch;
+    // Second search state for searches running from both ends at once
+    static thread_local SearchScratch reverse_scratch;
+    std::vector<std::pair<StationID, Distance>> route_from_parents(StationIdx to) const;
+    std::vector<std::pair<StationID, Distance>> route_from_path(std::vector<StationIdx> const& path) const;
+    // Stations settled by the calling thread's last route_shortest_distance
+    static thread_local unsigned int last_settled;
+    // Searches behind the route queries, called once the stations are known
+    std::vector<std::pair<StationID, Distance>> any_route(StationIdx from, StationIdx to) const;
+    std::vector<std::pair<StationID, Distance>> least_stations_route(StationIdx from, StationIdx to) const;
+    std::vector<std::pair<StationID, Distance>> shortest_distance_route(StationIdx from, StationIdx to) const;
+    std::vector<std::pair<StationID, Time>> earliest_arrival_route(StationIdx from, StationIdx to, Time starttime) const;
+
+    // Route cache, most recently used entry first. An entry is valid while the version it was
+    // stored with is current: link_version changes with train links and station coordinates,
+    // timetable_version also with departures, so only the timed queries depend on the latter.
+    // The versions change only under the write lock, the entries under route_cache_mutex.
+    enum class RouteQuery : unsigned char {ANY, LEAST_STATIONS, SHORTEST_DISTANCE, EARLIEST_ARRIVAL};
+    struct RouteKey{
+        StationIdx from;
+        StationIdx to;
+        RouteQuery query;
+        Time start;
+        bool operator==(RouteKey const& other) const;
     };
-    // Vector to store all RIDs
+    struct RouteKeyHash{
+        std::size_t operator()(RouteKey const& key) const;
+    };
+    struct CachedRoute{
+        RouteKey key;
+        unsigned long version;
+        // Only the one matching the query is used
+        std::vector<std::pair<StationID, Distance>> route;
+        std::vector<std::pair<StationID, Time>> timed_route;
+    };
+    mutable std::list<CachedRoute> route_cache;
+    mutable std::unordered_map<RouteKey, std::list<CachedRoute>::iterator, RouteKeyHash> route_cache_index;
+    mutable RouteCacheStats route_cache_counts;
+    mutable std::mutex route_cache_mutex;
+    unsigned long link_version = 0;
+    unsigned long timetable_version = 0;
+    unsigned long route_version(RouteKey const& key) const;
+    CachedRoute* find_cached_route(RouteKey const& key) const;
+    CachedRoute& store_cached_route(RouteKey const& key) const;
+    void trim_route_cache() const;
+
+    // Goal directed search: lower bounds for the distance still left to the destination.
+    // heuristic_scale times the straight line distance never exceeds the length of a route
+    // because no link is shorter than heuristic_scale times its straight line. Landmark
+    // distances are stored per station, landmark_from[station * landmark_count + i] is the
+    // distance from landmark i to station and landmark_to the distance back.
+    bool goal_directed = true;
+    mutable double heuristic_scale = 1;
+    unsigned int landmark_count = 0;
+    mutable std::vector<Distance> landmark_from;
+    mutable std::vector<Distance> landmark_to;
+    mutable std::atomic<bool> goal_dirty{false};
+    void update_goal_bounds() const;
+    void landmark_distances(StationIdx landmark, bool reverse, unsigned int slot) const;
+    Distance distance_estimate(StationIdx station, StationIdx to) const;
+
+    // Contraction hierarchy over train links weighted by distance(). Links and shortcuts
+    // going to a later contracted station are in hierarchy_up of their start, the others
+    // in hierarchy_down of their end (to is then the start), both as CSR arrays.
+    struct Shortcut{
+        StationIdx to;
+        Distance length;
+        // Station the shortcut bypasses, NO_INDEX for a train link
+        StationIdx middle;
+    };
+    // Settled stations after which a witness search gives up and keeps the shortcut
+    static constexpr unsigned int WITNESS_LIMIT = 64;
+    mutable std::vector<unsigned int> hierarchy_rank;
+    mutable std::vector<unsigned int> hierarchy_up_first;
+    mutable std::vector<Shortcut> hierarchy_up;
+    mutable std::vector<unsigned int> hierarchy_down_first;
+    mutable std::vector<Shortcut> hierarchy_down;
+    // The hierarchy is only kept up to date after build_distance_hierarchy has been called.
+    bool hierarchy_enabled = false;
+    mutable std::atomic<bool> hierarchy_dirty{false};
+    void links_changed();
+    void station_added(StationIdx station);
+    void update_hierarchy() const;
+    Shortcut const& hierarchy_link(StationIdx from, StationIdx to) const;
+    void unpack_link(StationIdx from, StationIdx to, std::vector<StationIdx>& path) const;
+    std::vector<std::pair<StationID, Distance>> route_in_hierarchy(StationIdx from, StationIdx to) const;
+
+    // Strongly connected components of the train links, numbered in the order they are finished
+    // so a link never goes to a component with a larger number. component_lowest is the smallest
+    // component reachable from a component and component_cycle whether a cycle can be reached.
+    // component_reach has a row of component_words 64-bit words per component with a bit set
+    // for every component it reaches. It is only built while the rows take at most
+    // REACH_BITS_LIMIT bits (16 MiB), beyond that may_reach only checks component_lowest
+    // and can answer true for components that aren't reachable.
+    static constexpr std::size_t REACH_BITS_LIMIT = std::size_t(1) << 27;
+    mutable std::vector<unsigned int> station_component;
+    mutable std::vector<unsigned int> component_lowest;
+    mutable std::vector<bool> component_cycle;
+    mutable std::vector<std::uint64_t> component_reach;
+    mutable std::size_t component_words = 0;
+    mutable std::atomic<bool> components_dirty{false};
+    void update_components() const;
+    bool may_reach(StationIdx from, StationIdx to) const;
+
+    // Sorted views: the first *_sorted elements are in order, the rest were added
+    // after the last query and get merged in on the next one
+    mutable std::vector<StationIdx> alphabetical_order;
+    mutable std::vector<StationIdx> coordinates;
+    mutable std::size_t alphabetical_sorted = 0;
+    mutable std::size_t coordinates_sorted = 0;
+    // Stations moved since the last merge: their entry in the sorted part of coordinates is
+    // out of place and another one is in the unsorted tail
+    mutable std::unordered_set<StationIdx> coordinates_moved;
+    // Station IDs of the sorted views, valid when the matching *_dirty flag is false
+    mutable std::vector<StationID> alphabetical_IDs;
+    mutable std::vector<StationID> coordinates_IDs;
+    mutable std::atomic<bool> alphabetical_dirty{false};
+    mutable std::atomic<bool> coordinates_dirty{false};
+    void update_alphabetical() const;
+    void update_coordinates() const;
+
+    // Spatial index: stations bucketed into square grid cells of GRID_CELL_SIZE,
+    // used for exact coordinate lookups
+    static constexpr int GRID_CELL_SIZE = 1024;
+    std::unordered_map<Coord, std::vector<StationIdx>, CoordHash> grid;
+    Coord grid_cell(Coord xy) const;
+    void grid_insert(StationIdx station);
+    void grid_erase(StationIdx station);
+
+    // Nearest station index: a balanced k-d tree stored in an array, the node of range
+    // [lo, hi) is at (lo + hi) / 2 and splits on x at even depths and on y at odd ones.
+    // nearest_coords holds the coordinates the tree was built with, an entry whose station
+    // has since moved or been removed is skipped. Stations added or moved after the build
+    // are in nearest_pending and get checked one by one until the tree is rebuilt.
+    static constexpr std::size_t NEAREST_SLACK = 64;
+    mutable std::vector<StationIdx> nearest_tree;
+    mutable std::vector<Coord> nearest_coords;
+    mutable std::vector<StationIdx> nearest_pending;
+    mutable std::size_t nearest_stale = 0;
+    mutable std::atomic<bool> nearest_dirty{false};
+    void update_nearest() const;
+    void nearest_changed();
+
+    // Train IDs seen in add_train or add_departure, indexed by TrainIdx
+    std::unordered_map<TrainID, TrainIdx> train_index;
+    std::vector<TrainID> train_IDs;
+    // Stations and times of trains added with add_train, empty for other trains
+    std::vector<std::vector<std::pair<StationIdx, Time>>> train_stops;
+    std::vector<bool> train_added;
+    // Position of the first stop of a train at a station in train_stops, keyed by stop_key
+    std::unordered_map<std::uint64_t, unsigned int> stop_index;
+    static std::uint64_t stop_key(StationIdx station, TrainIdx train);
+    void index_stops(TrainIdx train);
+    void unindex_stops(TrainIdx train);
+
+    // Connection scan: every hop of every added train as an elementary connection. The
+    // first connections_sorted are in departure order, connections of trains added after
+    // the last query are merged in on the next one.
+    struct Connection{
+        Time departure;
+        Time arrival;
+        StationIdx from;
+        StationIdx to;
+        TrainIdx train;
+        // Position of the hop on the train's route, orders hops with equal times
+        unsigned int stop;
+    };
+    mutable std::vector<Connection> connections;
+    mutable std::size_t connections_sorted = 0;
+    mutable std::atomic<bool> connections_dirty{false};
+    // Set when station indexes change, connections are then rebuilt from train_stops
+    mutable bool connections_stale = false;
+    // Connections of removed or retimed trains get from NO_INDEX and are dropped by the next
+    // update. connection_tail is where the connections of a train start in the unsorted tail,
+    // NO_INDEX once they have been merged into the sorted part.
+    mutable std::size_t connections_retired = 0;
+    mutable std::vector<unsigned int> connection_tail;
+    static bool connection_before(Connection const& first, Connection const& second);
+    void append_connections(TrainIdx train) const;
+    void retire_connections(TrainIdx train);
+    void retime_train(TrainIdx train, std::vector<Time> const& times);
+    void update_connections() const;
+    unsigned int train_stop_position(TrainIdx train, StationIdx station, Time time) const;
+
+    // Information about regions, stored as struct of arrays indexed by RegionIdx
+    std::unordered_map<RegionID, RegionIdx> region_index;
     std::vector<RegionID> region_IDs;
-    std::unordered_map<RegionID, Region> regions;
+    std::vector<Name> region_names;
+    std::vector<std::vector<Coord>> region_coords;
+    std::vector<RegionIdx> region_parent;
+    std::vector<std::vector<RegionIdx>> region_subregions;
+    std::vector<std::vector<StationIdx>> region_stations;
+
+    // Region tree index: depth and 2^k:th ancestors of every region (binary lifting)
+    std::vector<unsigned int> region_depth;
+    std::vector<std::vector<RegionIdx>> region_up;
+    void update_region_ancestry(RegionIdx root);
+    RegionIdx region_ancestor(RegionIdx region, unsigned int levels) const;
+    RegionIdx lowest_common_region(RegionIdx region1, RegionIdx region2) const;
+    // Bounding boxes of region polygons and a packed R-tree over them, rebuilt lazily.
+    // Level 0 nodes point to ranges of region_tree_items, upper levels to the level below.
+    struct BoxNode{
+        Coord low;
+        Coord high;
+        unsigned int first;
+        unsigned int count;
+    };
+    std::vector<BoxNode> region_bounds;
+    mutable std::vector<RegionIdx> region_tree_items;
+    mutable std::vector<std::vector<BoxNode>> region_tree;
+    mutable std::atomic<bool> region_tree_dirty{false};
+    static BoxNode bounding_box(std::vector<Coord> const& coords);
+    void update_region_tree() const;
+    bool polygon_contains(RegionIdx region, Coord xy) const;
+    // Euler tour: subregions of a region are euler_order[region_tin + 1, region_tout)
+    mutable std::vector<unsigned int> region_tin;
+    mutable std::vector<unsigned int> region_tout;
+    mutable std::vector<RegionIdx> euler_order;
+    mutable std::atomic<bool> euler_dirty{false};
+    void update_euler_tour() const;
+
+    // Snapshot loading: every index read from the file is range checked, departures checked
+    // to be in order and the region tree checked for cycles before any lookup table or index
+    // is built from the arrays. Train links are made from train_stops, not read.
+    bool snapshot_consistent() const;
 
 };
 
@@ -0,0 +1,528 @@
+// Tests.cc
+//
+// Tests of Datastructures, run by ctest. Regression tests of single cases and
+// random timetables checked against brute force reference searches. Prints
+// the checks that failed and exits with 1 if any did.
+//
+// Build and run with the tests target of CMakeLists.txt:
+//   cmake -S . -B build && cmake --build build && ctest --test-dir build
+
+
+#include "datastructures.hh"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+unsigned int failures = 0;
+
+/**
+ * @brief check, record the result of one check
+ * @param passed, did the check pass
+ * @param what, description printed if it didn't
+ */
+void check(bool passed, std::string const& what)
+{
+    if(!passed){
+        std::cout << "FAILED: " << what << std::endl;
+        failures++;
+    }
+}
+
+/**
+ * @brief add_stations, add stations s0 .. s(count-1) on a line
+ * @param ds, datastructures to add to
+ * @param count, number of stations
+ */
+void add_stations(Datastructures& ds, unsigned int count)
+{
+    for(unsigned int i = 0; i < count; i++){
+        ds.add_station("s" + std::to_string(i), "Station " + std::to_string(i), {static_cast<int>(i) * 10, 0});
+    }
+}
+
+// Random timetable kept outside Datastructures, the reference searches below work on it
+struct Timetable
+{
+    std::vector<StationID> stations;
+    std::vector<std::pair<TrainID, std::vector<std::pair<unsigned int, Time>>>> trains;
+};
+
+unsigned int const UNREACHED = std::numeric_limits<unsigned int>::max();
+
+/**
+ * @brief random_timetable, add random stations and trains, some hops of which go backwards in time
+ * @param ds, datastructures to add to
+ * @param engine, random number generator
+ * @param station_count, number of stations
+ * @param train_count, number of trains
+ * @return the stations and trains that were added
+ */
+Timetable random_timetable(Datastructures& ds, std::mt19937& engine, unsigned int station_count, unsigned int train_count)
+{
+    Timetable timetable;
+    auto random_below = [&engine](unsigned int end){return std::uniform_int_distribution<unsigned int>(0, end - 1)(engine);};
+    for(unsigned int i = 0; i < station_count; i++){
+        timetable.stations.push_back("s" + std::to_string(i));
+        ds.add_station(timetable.stations.back(), "Station", {static_cast<int>(random_below(1000)), static_cast<int>(random_below(1000))});
+    }
+    for(unsigned int i = 0; i < train_count; i++){
+        std::vector<std::pair<unsigned int, Time>> stops;
+        std::vector<std::pair<StationID, Time>> stationtimes;
+        unsigned int time = random_below(200);
+        unsigned int length = 2 + random_below(5);
+        for(unsigned int j = 0; j < length; j++){
+            unsigned int station = random_below(station_count);
+            stops.push_back({station, static_cast<Time>(time)});
+            stationtimes.push_back({timetable.stations[station], static_cast<Time>(time)});
+            // One hop in six goes backwards, some take no time at all
+            if(random_below(6) == 0){
+                time -= std::min(time, random_below(60));
+            } else {
+                time += random_below(40);
+            }
+        }
+        timetable.trains.push_back({"t" + std::to_string(i), stops});
+        ds.add_train(timetable.trains.back().first, stationtimes);
+    }
+    return timetable;
+}
+
+/**
+ * @brief reference_arrivals, earliest arrivals by riding trains until nothing improves
+ * @param timetable, stations and trains
+ * @param from, index of the station where the journeys start
+ * @param starttime, earliest time to leave
+ * @return earliest arrival time at every station, UNREACHED if there is none
+ */
+std::vector<unsigned int> reference_arrivals(Timetable const& timetable, unsigned int from, unsigned int starttime)
+{
+    std::vector<unsigned int> arrival(timetable.stations.size(), UNREACHED);
+    arrival[from] = starttime;
+    bool improved = true;
+    while(improved){
+        improved = false;
+        for(auto &train : timetable.trains){
+            auto &stops = train.second;
+            bool riding = false;
+            for(std::size_t i = 0; i < stops.size(); i++){
+                auto &[station, time] = stops[i];
+                if(riding && time < arrival[station]){
+                    arrival[station] = time;
+                    improved = true;
+                }
+                // A hop going backwards in time can't be ridden, everyone gets off before it
+                riding = i + 1 < stops.size() && stops[i+1].second >= time && arrival[station] <= time;
+            }
+        }
+    }
+    return arrival;
+}
+
+/**
+ * @brief rides_hop, does some train go from one stop to the next at the given times
+ * @param timetable, stations and trains
+ * @param from, station of the first stop
+ * @param departure, time at the first stop
+ * @param to, station of the next stop
+ * @param latest, latest time the train may be at the next stop
+ * @return true if there is such a hop going forwards in time
+ */
+bool rides_hop(Timetable const& timetable, unsigned int from, unsigned int departure, unsigned int to, unsigned int latest)
+{
+    for(auto &train : timetable.trains){
+        auto &stops = train.second;
+        for(std::size_t i = 0; i + 1 < stops.size(); i++){
+            if(stops[i].first == from && stops[i].second == departure && stops[i+1].first == to
+                    && stops[i+1].second >= stops[i].second && stops[i+1].second <= latest){
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief test_backwards_times_earliest_arrival, a hop arriving before it departs can't be
+ *        ridden, and the train can't be stayed on over it either
+ */
+void test_backwards_times_earliest_arrival()
+{
+    Datastructures ds;
+    add_stations(ds, 5);
+    ds.add_train("t", {{"s3", 5}, {"s1", 51}, {"s4", 13}, {"s0", 31}});
+    check(ds.route_earliest_arrival("s3", "s0", 1).empty(), "earliest arrival over a backwards hop");
+    std::vector<std::pair<StationID, Time>> expected = {{"s4", 13}, {"s0", 31}};
+    check(ds.route_earliest_arrival("s4", "s0", 1) == expected, "earliest arrival after a backwards hop");
+}
+
+/**
+ * @brief test_backwards_times_within_time, stations behind a backwards hop are reached only
+ *        by boarding after it
+ */
+void test_backwards_times_within_time()
+{
+    Datastructures ds;
+    add_stations(ds, 5);
+    ds.add_train("t", {{"s3", 5}, {"s1", 51}, {"s4", 13}, {"s0", 31}});
+    Reachable result;
+    check(ds.stations_within_time("s3", 1, 100, result), "stations within time from an existing station");
+    std::vector<StationID> expected = {"s3", "s1"};
+    check(result.stations == expected, "stations within time over a backwards hop");
+    check(result.previous.size() == 2 && result.previous[1] == 0, "previous station within time");
+}
+
+/**
+ * @brief test_backwards_times_profile, journeys can't stay on a train over a backwards hop
+ */
+void test_backwards_times_profile()
+{
+    Datastructures ds;
+    add_stations(ds, 5);
+    ds.add_train("t", {{"s3", 5}, {"s1", 51}, {"s4", 13}, {"s0", 31}});
+    check(ds.journeys_profile("s3", "s0", 0, 100).empty(), "profile over a backwards hop");
+    std::vector<std::pair<Time, Time>> expected = {{13, 31}};
+    check(ds.journeys_profile("s4", "s0", 0, 100) == expected, "profile after a backwards hop");
+}
+
+/**
+ * @brief test_snapshot_corruption, a snapshot with any byte flipped is either rejected or
+ *        loaded into a network the other operations can work on
+ */
+void test_snapshot_corruption()
+{
+    std::string const filename = "tests_snapshot.bin";
+    {
+        Datastructures ds;
+        add_stations(ds, 6);
+        ds.add_train("t1", {{"s0", 5}, {"s1", 10}, {"s2", 20}});
+        ds.add_train("t2", {{"s2", 8}, {"s4", 12}, {"s5", 30}, {"s0", 31}});
+        ds.add_departure("s3", "t3", 40);
+        ds.remove_station("s1");
+        check(ds.save_snapshot(filename), "saving a snapshot");
+    }
+    std::string saved;
+    {
+        std::ifstream file(filename, std::ios::binary);
+        saved.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    unsigned int loaded = 0;
+    for(std::size_t i = 0; i < saved.size(); i++){
+        std::string broken = saved;
+        broken[i] = static_cast<char>(broken[i] ^ 0x5a);
+        {
+            std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+            file << broken;
+        }
+        Datastructures ds;
+        try{
+            if(ds.load_snapshot(filename)){
+                loaded++;
+                auto stations = ds.all_stations();
+                for(auto &station : stations){
+                    ds.next_stations_from(station);
+                    ds.station_departures_after(station, 0);
+                    ds.route_earliest_arrival(station, stations.front(), 0);
+                }
+                if(!stations.empty()){
+                    ds.remove_station(stations.front());
+                }
+                ds.compact_stations();
+            }
+        } catch(std::exception const& error){
+            check(false, "loading a snapshot with byte " + std::to_string(i) + " flipped: " + error.what());
+        }
+    }
+    check(loaded < saved.size(), "flipped bytes are noticed");
+    std::remove(filename.c_str());
+}
+
+/**
+ * @brief test_remove_station, trains skip a removed station and its region forgets it
+ */
+void test_remove_station()
+{
+    Datastructures ds;
+    add_stations(ds, 5);
+    ds.add_region(1, "Region", {{0, 0}, {100, 0}, {0, 100}});
+    for(unsigned int i = 0; i < 5; i++){
+        ds.add_station_to_region("s" + std::to_string(i), 1);
+    }
+    ds.add_train("t", {{"s0", 5}, {"s1", 10}, {"s2", 20}, {"s3", 30}});
+    // Builds the search graph, so that removing has to patch it
+    check(ds.route_shortest_distance("s0", "s3").size() == 4, "route before removing");
+    check(ds.remove_station("s1"), "removing an existing station");
+    check(!ds.remove_station("s1"), "removing a station twice");
+    std::vector<std::pair<StationID, Distance>> expected = {{"s0", 0}, {"s2", 20}, {"s3", 30}};
+    check(ds.route_shortest_distance("s0", "s3") == expected, "route over a removed station");
+    check(ds.next_stations_from("s0") == std::vector<StationID>{"s2"}, "link over a removed station");
+    check(ds.station_in_regions("s1") == std::vector<RegionID>{NO_REGION}, "regions of a removed station");
+    for(auto station : {"s0", "s2", "s3", "s4"}){
+        check(ds.station_in_regions(station) == std::vector<RegionID>{1}, std::string("regions of ") + station);
+    }
+    check(ds.remove_station("s4") && ds.remove_station("s0"), "removing the last and first station of a region");
+    check(ds.station_in_regions("s2") == std::vector<RegionID>{1}, "regions after more removals");
+    // Loading checks that the region's station list matches the stations' regions
+    std::string const filename = "tests_remove_station.bin";
+    Datastructures loaded;
+    check(ds.save_snapshot(filename) && loaded.load_snapshot(filename), "snapshot after removals");
+    check(loaded.station_in_regions("s3") == std::vector<RegionID>{1}, "regions after loading");
+    std::remove(filename.c_str());
+}
+
+/**
+ * @brief test_random_earliest_arrival, route_earliest_arrival against reference_arrivals on
+ *        random timetables, each leg of a route has to be a hop of some train
+ */
+void test_random_earliest_arrival()
+{
+    std::mt19937 engine(1);
+    for(unsigned int round = 0; round < 20; round++){
+        Datastructures ds;
+        auto timetable = random_timetable(ds, engine, 12, 10);
+        for(unsigned int from = 0; from < timetable.stations.size(); from++){
+            for(unsigned int starttime : {0u, 60u, 150u}){
+                auto arrival = reference_arrivals(timetable, from, starttime);
+                for(unsigned int to = 0; to < timetable.stations.size(); to++){
+                    if(from == to){
+                        continue;
+                    }
+                    auto route = ds.route_earliest_arrival(timetable.stations[from], timetable.stations[to], starttime);
+                    std::string what = "earliest arrival " + std::to_string(round) + ": " + timetable.stations[from]
+                            + " -> " + timetable.stations[to] + " at " + std::to_string(starttime);
+                    if(arrival[to] == UNREACHED){
+                        check(route.empty(), what + " is unreachable");
+                        continue;
+                    }
+                    if(route.size() < 2){
+                        check(false, what + " is reachable");
+                        continue;
+                    }
+                    check(route.back().second == arrival[to], what + " arrives first");
+                    check(route.front().second >= starttime, what + " leaves after starttime");
+                    for(std::size_t i = 0; i + 1 < route.size(); i++){
+                        unsigned int leg_from = std::stoul(route[i].first.substr(1));
+                        unsigned int leg_to = std::stoul(route[i+1].first.substr(1));
+                        // The train reaches the next station by the time the route leaves it
+                        check(rides_hop(timetable, leg_from, route[i].second, leg_to, route[i+1].second), what + " rides leg " + std::to_string(i));
+                    }
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief test_random_profile, journeys_profile against reference_arrivals for every starttime
+ *        at which the best journey can change
+ */
+void test_random_profile()
+{
+    std::mt19937 engine(2);
+    for(unsigned int round = 0; round < 20; round++){
+        Datastructures ds;
+        auto timetable = random_timetable(ds, engine, 10, 8);
+        std::vector<unsigned int> times = {0};
+        for(auto &train : timetable.trains){
+            for(auto &stop : train.second){
+                times.push_back(stop.second);
+            }
+        }
+        for(unsigned int from = 0; from < timetable.stations.size(); from++){
+            for(unsigned int to = 0; to < timetable.stations.size(); to++){
+                if(from == to){
+                    continue;
+                }
+                std::string what = "profile " + std::to_string(round) + ": " + timetable.stations[from] + " -> " + timetable.stations[to];
+                auto journeys = ds.journeys_profile(timetable.stations[from], timetable.stations[to], 0, NO_TIME - 1);
+                for(std::size_t i = 0; i + 1 < journeys.size(); i++){
+                    check(journeys[i].first < journeys[i+1].first && journeys[i].second < journeys[i+1].second,
+                          what + " is ordered");
+                }
+                // The best journey leaving at starttime or later is the first one of the profile leaving then
+                for(auto starttime : times){
+                    auto later = std::find_if(journeys.begin(), journeys.end(), [starttime](std::pair<Time, Time> const& journey){
+                        return journey.first >= starttime;
+                    });
+                    unsigned int profile_arrival = later == journeys.end() ? UNREACHED : later->second;
+                    check(profile_arrival == reference_arrivals(timetable, from, starttime)[to], what + " from " + std::to_string(starttime));
+                }
+                // A window keeps the journeys leaving in it
+                auto window = ds.journeys_profile(timetable.stations[from], timetable.stations[to], 50, 150);
+                std::vector<std::pair<Time, Time>> expected;
+                for(auto &journey : journeys){
+                    if(journey.first >= 50 && journey.first <= 150){
+                        expected.push_back(journey);
+                    }
+                }
+                check(window == expected, what + " in a window");
+            }
+        }
+    }
+}
+
+/**
+ * @brief test_random_within_time, stations_within_time against reference_arrivals, the previous
+ *        station of each has to reach it with one hop
+ */
+void test_random_within_time()
+{
+    std::mt19937 engine(3);
+    for(unsigned int round = 0; round < 20; round++){
+        Datastructures ds;
+        auto timetable = random_timetable(ds, engine, 12, 10);
+        for(unsigned int from = 0; from < timetable.stations.size(); from++){
+            unsigned int const starttime = 30;
+            unsigned int const budget = 80;
+            std::string what = "within time " + std::to_string(round) + ": from " + timetable.stations[from];
+            auto arrival = reference_arrivals(timetable, from, starttime);
+            Reachable result;
+            check(ds.stations_within_time(timetable.stations[from], starttime, budget, result), what + " exists");
+            std::size_t expected_count = std::count_if(arrival.begin(), arrival.end(), [](unsigned int time){
+                return time <= starttime + budget;
+            });
+            check(result.stations.size() == expected_count, what + " finds every station");
+            for(std::size_t i = 0; i < result.stations.size(); i++){
+                unsigned int station = std::stoul(result.stations[i].substr(1));
+                check(static_cast<unsigned int>(result.costs[i]) == arrival[station] - starttime, what + " cost of " + result.stations[i]);
+                check(i == 0 || result.costs[i-1] <= result.costs[i], what + " is ordered");
+                if(station == from){
+                    check(result.previous[i] == NO_VALUE, what + " start has no previous");
+                    continue;
+                }
+                if(result.previous[i] < 0 || static_cast<std::size_t>(result.previous[i]) >= result.stations.size()){
+                    check(false, what + " previous of " + result.stations[i]);
+                    continue;
+                }
+                unsigned int previous = std::stoul(result.stations[result.previous[i]].substr(1));
+                bool hop = false;
+                for(auto &train : timetable.trains){
+                    auto &stops = train.second;
+                    for(std::size_t j = 0; j + 1 < stops.size(); j++){
+                        hop = hop || (stops[j].first == previous && stops[j+1].first == station && stops[j].second >= arrival[previous]
+                                      && stops[j+1].second >= stops[j].second && stops[j+1].second == arrival[station]);
+                    }
+                }
+                check(hop, what + " previous of " + result.stations[i] + " reaches it");
+            }
+        }
+    }
+}
+
+/**
+ * @brief test_random_remove_station, earliest arrivals after removing stations against a
+ *        timetable whose trains skip the removed stations
+ */
+void test_random_remove_station()
+{
+    std::mt19937 engine(4);
+    for(unsigned int round = 0; round < 10; round++){
+        Datastructures ds;
+        auto timetable = random_timetable(ds, engine, 15, 12);
+        std::vector<bool> removed(timetable.stations.size(), false);
+        for(unsigned int removal = 0; removal < 6; removal++){
+            unsigned int station = engine() % timetable.stations.size();
+            check(ds.remove_station(timetable.stations[station]) != removed[station], "removing a station once");
+            removed[station] = true;
+            for(auto &train : timetable.trains){
+                auto &stops = train.second;
+                stops.erase(std::remove_if(stops.begin(), stops.end(), [station](std::pair<unsigned int, Time> const& stop){
+                    return stop.first == station;
+                }), stops.end());
+            }
+            for(unsigned int from = 0; from < timetable.stations.size(); from++){
+                if(removed[from]){
+                    continue;
+                }
+                auto arrival = reference_arrivals(timetable, from, 0);
+                for(unsigned int to = 0; to < timetable.stations.size(); to++){
+                    if(from == to || removed[to]){
+                        continue;
+                    }
+                    auto route = ds.route_earliest_arrival(timetable.stations[from], timetable.stations[to], 0);
+                    unsigned int route_arrival = route.empty() ? UNREACHED : route.back().second;
+                    check(route_arrival == arrival[to], "earliest arrival " + std::to_string(round) + " after removing stations: "
+                          + timetable.stations[from] + " -> " + timetable.stations[to]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief test_random_snapshot, a loaded snapshot answers like the network it was saved from
+ */
+void test_random_snapshot()
+{
+    std::mt19937 engine(5);
+    std::string const filename = "tests_random_snapshot.bin";
+    for(unsigned int round = 0; round < 10; round++){
+        Datastructures ds;
+        auto timetable = random_timetable(ds, engine, 15, 12);
+        ds.add_region(1, "Region", {{0, 0}, {500, 0}, {0, 500}});
+        ds.add_region(2, "Subregion", {{0, 0}, {100, 0}, {0, 100}});
+        ds.add_subregion_to_region(2, 1);
+        ds.add_station_to_region("s0", 2);
+        ds.add_station_to_region("s1", 1);
+        ds.add_departure("s2", "extra", 77);
+        ds.remove_station("s3");
+        ds.remove_departure("s4", "t0", 10);
+        std::string what = "snapshot " + std::to_string(round);
+        Datastructures loaded;
+        check(ds.save_snapshot(filename) && loaded.load_snapshot(filename), what + " saves and loads");
+        auto stations = ds.all_stations();
+        auto loaded_stations = loaded.all_stations();
+        std::sort(stations.begin(), stations.end());
+        std::sort(loaded_stations.begin(), loaded_stations.end());
+        check(stations == loaded_stations, what + " stations");
+        check(ds.stations_alphabetically() == loaded.stations_alphabetically(), what + " stations alphabetically");
+        check(ds.stations_distance_increasing() == loaded.stations_distance_increasing(), what + " stations by distance");
+        for(auto &from : stations){
+            check(ds.get_station_coordinates(from) == loaded.get_station_coordinates(from), what + " coordinates of " + from);
+            check(ds.station_departures_after(from, 0) == loaded.station_departures_after(from, 0), what + " departures of " + from);
+            check(ds.station_in_regions(from) == loaded.station_in_regions(from), what + " regions of " + from);
+            // Links keep no particular order through a snapshot
+            auto next = ds.next_stations_from(from);
+            auto loaded_next = loaded.next_stations_from(from);
+            std::sort(next.begin(), next.end());
+            std::sort(loaded_next.begin(), loaded_next.end());
+            check(next == loaded_next, what + " next stations of " + from);
+            for(auto &to : stations){
+                if(from == to){
+                    continue;
+                }
+                auto route = ds.route_earliest_arrival(from, to, 0);
+                auto loaded_route = loaded.route_earliest_arrival(from, to, 0);
+                check(route.empty() == loaded_route.empty() && (route.empty() || route.back() == loaded_route.back()),
+                      what + " earliest arrival " + from + " -> " + to);
+                check(ds.route_least_stations(from, to).size() == loaded.route_least_stations(from, to).size(),
+                      what + " least stations " + from + " -> " + to);
+            }
+        }
+    }
+    std::remove(filename.c_str());
+}
+
+int main()
+{
+    test_backwards_times_earliest_arrival();
+    test_backwards_times_within_time();
+    test_backwards_times_profile();
+    test_snapshot_corruption();
+    test_remove_station();
+    test_random_earliest_arrival();
+    test_random_profile();
+    test_random_within_time();
+    test_random_remove_station();
+    test_random_snapshot();
+    if(failures == 0){
+        std::cout << "All tests passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}